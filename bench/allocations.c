@@ -0,0 +1,71 @@
+// Counts heap allocations made by the external scanner per KB of input.
+//
+//   cc -O2 -Isrc bench/allocations.c src/parser.c -ltree-sitter \
+//     -o allocations
+//   ./allocations [page.jsp ...]
+//
+// Without arguments, synthetic table-heavy and taglib-heavy pages are used.
+
+#include <tree_sitter/api.h>
+
+#include <stdlib.h>
+
+static unsigned long allocations;
+
+static void *counting_malloc(size_t size) {
+  allocations++;
+  return malloc(size);
+}
+
+static void *counting_calloc(size_t count, size_t size) {
+  allocations++;
+  return calloc(count, size);
+}
+
+static void *counting_realloc(void *pointer, size_t size) {
+  allocations++;
+  return realloc(pointer, size);
+}
+
+#define ts_malloc counting_malloc
+#define ts_calloc counting_calloc
+#define ts_realloc counting_realloc
+#include "../src/scanner.c"
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+static void report(const char *name, const Page *page) {
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+
+  allocations = 0;
+  TSTree *tree =
+      ts_parser_parse_string(parser, NULL, page->contents, page->size);
+  double kb = page->size / 1024.0;
+  printf("%-24s %8.1f KB %10.2f allocations/KB\n", name, kb,
+         allocations / kb);
+
+  ts_tree_delete(tree);
+  ts_parser_delete(parser);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      Page page = page_read(argv[i]);
+      report(argv[i], &page);
+      page_free(&page);
+    }
+    return 0;
+  }
+
+  Page table = page_table(2000);
+  Page taglib = page_taglib(1000);
+  report("table", &table);
+  report("taglib", &taglib);
+  page_free(&table);
+  page_free(&taglib);
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Records the serialize and deserialize calls tree-sitter makes while parsing
+// a page, then replays them against a fresh scanner. The replay time, serialize
+// calls included, is reported per deserialize call.
+//
+//   cc -O2 -Isrc bench/deserialize.c src/parser.c -ltree-sitter \
+//     -o deserialize
+//   ./deserialize [page.jsp ...]
+//
+// Without arguments, synthetic taglib-heavy pages nested 10 and 60 levels
+// deep and a table-heavy page are used.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <tree_sitter/api.h>
+
+#include <time.h>
+
+#define tree_sitter_jsp_external_scanner_serialize scanner_serialize_entry
+#define tree_sitter_jsp_external_scanner_deserialize scanner_deserialize_entry
+#include "../src/scanner.c"
+#undef tree_sitter_jsp_external_scanner_serialize
+#undef tree_sitter_jsp_external_scanner_deserialize
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+// A recorded call: SERIALIZE_CALL, or the length of a deserialized state
+// followed by its bytes.
+#define SERIALIZE_CALL UINT32_MAX
+
+static Array(char) calls;
+static unsigned long deserialize_calls;
+
+static void record(uint32_t entry, const char *bytes, unsigned length) {
+  array_extend(&calls, sizeof(entry), (const char *)&entry);
+  array_extend(&calls, length, bytes);
+}
+
+unsigned tree_sitter_jsp_external_scanner_serialize(void *payload,
+                                                    char *buffer) {
+  record(SERIALIZE_CALL, NULL, 0);
+  return scanner_serialize_entry(payload, buffer);
+}
+
+void tree_sitter_jsp_external_scanner_deserialize(void *payload,
+                                                  const char *buffer,
+                                                  unsigned length) {
+  record(length, buffer, length);
+  deserialize_calls++;
+  scanner_deserialize_entry(payload, buffer, length);
+}
+
+static double now_ns(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static void replay(void) {
+  char buffer[TREE_SITTER_SERIALIZATION_BUFFER_SIZE];
+  void *scanner = tree_sitter_jsp_external_scanner_create();
+  for (uint32_t i = 0; i < calls.size;) {
+    uint32_t entry;
+    memcpy(&entry, &calls.contents[i], sizeof(entry));
+    i += sizeof(entry);
+    if (entry == SERIALIZE_CALL) {
+      scanner_serialize_entry(scanner, buffer);
+    } else {
+      scanner_deserialize_entry(scanner, &calls.contents[i], entry);
+      i += entry;
+    }
+  }
+  tree_sitter_jsp_external_scanner_destroy(scanner);
+}
+
+static void report(const char *name, const Page *page) {
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+  array_clear(&calls);
+  deserialize_calls = 0;
+  TSTree *tree =
+      ts_parser_parse_string(parser, NULL, page->contents, page->size);
+  ts_tree_delete(tree);
+  ts_parser_delete(parser);
+
+  double best = 0;
+  for (int run = 0; run < 10; run++) {
+    double start = now_ns();
+    replay();
+    double elapsed = now_ns() - start;
+    if (run == 0 || elapsed < best)
+      best = elapsed;
+  }
+  printf("%-24s %8lu deserialize calls %8.1f ns/call\n", name,
+         deserialize_calls, best / deserialize_calls);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      Page page = page_read(argv[i]);
+      report(argv[i], &page);
+      page_free(&page);
+    }
+  } else {
+    const unsigned depths[] = {10, 60};
+    for (unsigned i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+      char name[32];
+      snprintf(name, sizeof(name), "nested-%u", depths[i]);
+      Page page = page_nested(depths[i], 500);
+      report(name, &page);
+      page_free(&page);
+    }
+    Page table = page_table(2000);
+    report("table", &table);
+    page_free(&table);
+  }
+  array_delete(&calls);
+  return 0;
+}
@@ -0,0 +1,191 @@
+// Measures how much of a long script body, scriptlet and comment the scanner
+// relexes after a one-character edit inside it.
+//
+//   cc -O2 -Isrc bench/edit_latency.c -o edit_latency
+//   ./edit_latency [megabytes]
+//
+// The scanner is driven directly, the way tree-sitter's incremental reparse
+// drives it: lexing restarts at the token the edit falls in and stops as soon
+// as a new token ends where an old one did, after which the old tokens are
+// reused. When a body was a single token, every edit relexed all of it, which
+// is what the "whole body" column shows.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "../src/scanner.c"
+
+#include <time.h>
+
+#include "pages.h"
+#include "string_lexer.h"
+
+typedef struct {
+  const char *name;
+  // The opening delimiter, which the first token includes for a comment, and
+  // whether it is a start tag the scanner needs to have seen.
+  const char *opener;
+  bool opener_in_token;
+  bool is_start_tag;
+  // A format for the body's lines, given the line number.
+  const char *line;
+  const char *closer;
+  // The tokens valid at the start of the body and after one of its chunks,
+  // and the token that ends the body, if it has one of its own.
+  enum TokenType first[2];
+  enum TokenType next[2];
+  enum TokenType last[2];
+} Body;
+
+static const Body BODIES[] = {
+    {"script", "<script>", false, true,
+     "  if (rows[%u].depth < limit) html += '<tr><td>' + rows[i].name + "
+     "'</td></tr>';\n",
+     "</script>",
+     {RAW_TEXT, RAW_TEXT},
+     {RAW_TEXT, RAW_TEXT},
+     {TOKEN_TYPE_COUNT, TOKEN_TYPE_COUNT}},
+    {"scriptlet", "<%", false, false,
+     "  for (Row row : rows%u) { if (row.depth < limit) out.print(row); }\n",
+     "%>",
+     {JAVA_CONTENT, JAVA_CONTENT},
+     {JAVA_CONTENT, JAVA_CONTENT},
+     {TOKEN_TYPE_COUNT, TOKEN_TYPE_COUNT}},
+    {"comment", "<!--", true, false,
+     "  <tr><td><%%= row.getName() %%></td><td>${row%u.value}</td></tr>\n",
+     "-->",
+     {COMMENT, COMMENT_CHUNK},
+     {COMMENT_CHUNK, COMMENT_TAIL},
+     {COMMENT, COMMENT_TAIL}},
+};
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static Page page_body(const Body *body, size_t bytes) {
+  Page page = {0};
+  page_append(&page, "%s", body->opener);
+  for (unsigned i = 0; page.size < bytes; i++) {
+    page_append(&page, body->line, i);
+  }
+  page_append(&page, "%s", body->closer);
+  return page;
+}
+
+// A scanner in the state the parser would have inside the body: with the
+// script element open for a script body.
+static void *scanner_for_body(const Body *body, const Page *page) {
+  void *scanner = tree_sitter_jsp_external_scanner_create();
+  if (body->is_start_tag) {
+    bool valid_symbols[TOKEN_TYPE_COUNT] = {0};
+    valid_symbols[START_TAG_NAME] = true;
+    StringLexer lexer = string_lexer_new(page->contents, page->size);
+    string_lexer_reset(&lexer, 1);
+    tree_sitter_jsp_external_scanner_scan(scanner, &lexer.lexer,
+                                          valid_symbols);
+  }
+  return scanner;
+}
+
+// Scans the tokens of a body starting at `position`, where the token is the
+// first of the body if `first` is set, and returns the end of the last one.
+// Stops at the end of the body or, if `old_ends` is given, once a token ends
+// at an old token end past `edit` shifted by one.
+static size_t lex_body(const Body *body, void *scanner, const Page *page,
+                       size_t position, bool first, size_t **ends,
+                       size_t *count, const size_t *old_ends,
+                       size_t old_count, size_t edit) {
+  StringLexer lexer = string_lexer_new(page->contents, page->size);
+  for (;;) {
+    const enum TokenType *valid = first ? body->first : body->next;
+    bool valid_symbols[TOKEN_TYPE_COUNT] = {0};
+    valid_symbols[valid[0]] = valid_symbols[valid[1]] = true;
+    string_lexer_reset(&lexer, position);
+    if (!tree_sitter_jsp_external_scanner_scan(scanner, &lexer.lexer,
+                                               valid_symbols) ||
+        lexer.end == position)
+      return position;
+
+    position = lexer.end;
+    first = false;
+    if (ends) {
+      *ends = realloc(*ends, (*count + 1) * sizeof(size_t));
+      (*ends)[(*count)++] = position;
+    }
+    TSSymbol symbol = lexer.lexer.result_symbol;
+    if (symbol == body->last[0] || symbol == body->last[1])
+      return position;
+
+    if (old_ends && position > edit + 1) {
+      size_t low = 0, high = old_count;
+      while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (old_ends[middle] < position - 1) {
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+      if (low < old_count && old_ends[low] == position - 1)
+        return position;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 2;
+  const unsigned edits = 1000;
+  srand(1);
+
+  printf("%-10s %8s %10s %12s %14s %12s\n", "body", "chunks", "chunk size",
+         "whole body", "relexed/edit", "time/edit");
+  for (unsigned i = 0; i < sizeof(BODIES) / sizeof(BODIES[0]); i++) {
+    const Body *body = &BODIES[i];
+    Page page = page_body(body, megabytes << 20);
+    size_t start = body->opener_in_token ? 0 : strlen(body->opener);
+    void *scanner = scanner_for_body(body, &page);
+
+    size_t *ends = NULL, count = 0;
+    double whole_start = now();
+    size_t body_end =
+        lex_body(body, scanner, &page, start, true, &ends, &count, NULL, 0, 0);
+    double whole = now() - whole_start;
+
+    // Insert a character at random places and relex from the start of the
+    // token each one falls in.
+    Page edited = {0};
+    page_append(&edited, "%s ", page.contents);
+    size_t relexed = 0;
+    double time = 0;
+    for (unsigned j = 0; j < edits; j++) {
+      size_t edit = start + (size_t)rand() % (body_end - start);
+      memcpy(edited.contents, page.contents, edit);
+      edited.contents[edit] = 'x';
+      memcpy(edited.contents + edit + 1, page.contents + edit,
+             page.size - edit);
+
+      size_t token = 0;
+      while (ends[token] <= edit) {
+        token++;
+      }
+      size_t token_start = token == 0 ? start : ends[token - 1];
+      double edit_start = now();
+      size_t end = lex_body(body, scanner, &edited, token_start, token == 0,
+                            NULL, NULL, ends, count, edit);
+      time += now() - edit_start;
+      relexed += end - token_start;
+    }
+
+    printf("%-10s %8zu %7.1f KB %9.2f ms %11.1f KB %9.1f us\n", body->name,
+           count, (body_end - start) / 1024.0 / count, whole / 1e6,
+           relexed / 1024.0 / edits, time / 1e3 / edits);
+
+    tree_sitter_jsp_external_scanner_destroy(scanner);
+    free(ends);
+    page_free(&edited);
+    page_free(&page);
+  }
+  return 0;
+}
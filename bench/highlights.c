@@ -0,0 +1,108 @@
+// Measures what it costs to find namespaced tag names for highlighting: the
+// old `#match?` predicate against the structural pattern on tag_name.
+//
+//   cc -O2 -Isrc bench/highlights.c src/parser.c src/scanner.c -ltree-sitter \
+//     -o highlights
+//   ./highlights [iterations]
+//
+// Query cursors do not evaluate predicates, so the predicate is applied here
+// the way a highlighter applies it: every tag_name is captured, its text is
+// copied out and matched against the regex. The structural pattern only
+// captures tag names that have a prefix.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <tree_sitter/api.h>
+
+#include <regex.h>
+#include <time.h>
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+static const char *const QUERIES[][2] = {
+    {"#match?", "((tag_name) @keyword (#match? @keyword \":\"))"},
+    {"prefix", "(tag_name prefix: (namespace)) @keyword"},
+};
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// Runs `query` over the tree and returns the number of captures left after
+// the predicate, if the query has one.
+static unsigned run_query(const TSQuery *query, TSQueryCursor *cursor,
+                          TSNode root, const Page *page, const regex_t *regex,
+                          bool has_predicate) {
+  char text[256];
+  unsigned captures = 0;
+  TSQueryMatch match;
+  ts_query_cursor_exec(cursor, query, root);
+  while (ts_query_cursor_next_match(cursor, &match)) {
+    TSNode node = match.captures[0].node;
+    if (has_predicate) {
+      uint32_t start = ts_node_start_byte(node);
+      uint32_t length = ts_node_end_byte(node) - start;
+      if (length >= sizeof(text))
+        length = sizeof(text) - 1;
+      memcpy(text, &page->contents[start], length);
+      text[length] = '\0';
+      if (regexec(regex, text, 0, NULL, 0) != 0)
+        continue;
+    }
+    captures++;
+  }
+  return captures;
+}
+
+int main(int argc, char **argv) {
+  unsigned iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+  Page page = page_taglib(500);
+
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+  TSTree *tree = ts_parser_parse_string(parser, NULL, page.contents, page.size);
+  TSNode root = ts_tree_root_node(tree);
+
+  regex_t regex;
+  regcomp(&regex, ":", REG_EXTENDED | REG_NOSUB);
+  TSQueryCursor *cursor = ts_query_cursor_new();
+
+  printf("%-10s %10s %12s\n", "query", "captures", "us/query");
+  for (unsigned i = 0; i < sizeof(QUERIES) / sizeof(QUERIES[0]); i++) {
+    uint32_t error_offset;
+    TSQueryError error;
+    TSQuery *query = ts_query_new(tree_sitter_jsp(), QUERIES[i][1],
+                                  strlen(QUERIES[i][1]), &error_offset, &error);
+    if (!query) {
+      printf("%-10s query error %d at %u\n", QUERIES[i][0], error,
+             error_offset);
+      continue;
+    }
+
+    uint32_t step_count;
+    bool has_predicate =
+        ts_query_predicates_for_pattern(query, 0, &step_count) != NULL &&
+        step_count > 0;
+
+    unsigned captures = 0;
+    double start = now();
+    for (unsigned j = 0; j < iterations; j++) {
+      captures = run_query(query, cursor, root, &page, &regex, has_predicate);
+    }
+    double us = (now() - start) / 1e3 / iterations;
+
+    printf("%-10s %10u %12.1f\n", QUERIES[i][0], captures, us);
+    ts_query_delete(query);
+  }
+
+  ts_query_cursor_delete(cursor);
+  regfree(&regex);
+  ts_tree_delete(tree);
+  ts_parser_delete(parser);
+  page_free(&page);
+  return 0;
+}
@@ -0,0 +1,138 @@
+// Measures parse time and tree size on indentation-heavy pages, and how many
+// of the scanner's tokens are whitespace runs between other tokens.
+//
+//   cc -O2 -Isrc bench/indentation.c src/parser.c -ltree-sitter \
+//     -o indentation
+//   ./indentation [iterations]
+//
+// Each WHITESPACE token is a hidden leaf in the tree, so the count is the
+// number of subtrees the scanner adds over padding. Pages are parsed with
+// whitespace-only text kept, the default, and dropped.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <tree_sitter/api.h>
+
+#define tree_sitter_jsp_external_scanner_scan scanner_scan_entry
+#include "../src/scanner.c"
+#undef tree_sitter_jsp_external_scanner_scan
+
+#include <time.h>
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+static unsigned long whitespace_tokens;
+static unsigned long tokens;
+
+bool tree_sitter_jsp_external_scanner_scan(void *payload, TSLexer *lexer,
+                                           const bool *valid_symbols) {
+  if (!scanner_scan_entry(payload, lexer, valid_symbols))
+    return false;
+  tokens++;
+  if (lexer->result_symbol == WHITESPACE)
+    whitespace_tokens++;
+  return true;
+}
+
+// Rows nested `depth` levels deep, indented by two spaces per level, with
+// attributes on lines of their own and EL expressions written with spaces.
+static Page page_indented(unsigned depth, unsigned rows) {
+  Page page = {0};
+  for (unsigned i = 0; i < depth; i++) {
+    page_append(&page, "%*s<div class=\"level\">\n", 2 * i, "");
+  }
+  for (unsigned i = 0; i < rows; i++) {
+    page_append(&page,
+                "%*s<input type=\"text\"\n"
+                "%*s       name=\"row%u\"\n"
+                "%*s       value=\"${ row.values[%u] }\" />\n"
+                "%*s<span>   ${ row.label }   </span>\n",
+                2 * depth, "", 2 * depth, "", i, 2 * depth, "", i, 2 * depth,
+                "");
+  }
+  for (unsigned i = depth; i-- > 0;) {
+    page_append(&page, "%*s</div>\n", 2 * i, "");
+  }
+  return page;
+}
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static unsigned long count_nodes(TSTree *tree) {
+  TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
+  unsigned long count = 1;
+  for (;;) {
+    if (ts_tree_cursor_goto_first_child(&cursor) ||
+        ts_tree_cursor_goto_next_sibling(&cursor)) {
+      count++;
+      continue;
+    }
+    bool found = false;
+    while (ts_tree_cursor_goto_parent(&cursor)) {
+      if (ts_tree_cursor_goto_next_sibling(&cursor)) {
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+      break;
+    count++;
+  }
+  ts_tree_cursor_delete(&cursor);
+  return count;
+}
+
+static void report(const char *name, const Page *page, unsigned iterations,
+                   bool keep_whitespace_text) {
+  // Scanners copy the setting when the parser creates them.
+  tree_sitter_jsp_set_whitespace_text(keep_whitespace_text);
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+
+  tokens = whitespace_tokens = 0;
+  TSTree *tree =
+      ts_parser_parse_string(parser, NULL, page->contents, page->size);
+  unsigned long nodes = count_nodes(tree);
+  unsigned long scanned = tokens, whitespace = whitespace_tokens;
+  ts_tree_delete(tree);
+
+  double start = now();
+  for (unsigned i = 0; i < iterations; i++) {
+    tree = ts_parser_parse_string(parser, NULL, page->contents, page->size);
+    ts_tree_delete(tree);
+  }
+  double us = (now() - start) / 1e3 / iterations;
+
+  double kb = page->size / 1024.0;
+  printf("%-10s %-5s %8.1f %10.2f %10.1f %10.1f %10.1f\n", name,
+         keep_whitespace_text ? "kept" : "skip", kb, us / kb, nodes / kb,
+         scanned / kb, whitespace / kb);
+  ts_parser_delete(parser);
+}
+
+int main(int argc, char **argv) {
+  unsigned iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 50;
+  struct {
+    const char *name;
+    Page page;
+  } pages[] = {
+      {"shallow", page_indented(2, 2000)},
+      {"deep", page_indented(24, 2000)},
+      {"nested", page_nested(24, 1000)},
+  };
+
+  printf("%-10s %-5s %8s %10s %10s %10s %10s\n", "page", "text", "KB",
+         "us/KB", "nodes/KB", "tokens/KB", "blank/KB");
+  for (unsigned i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) {
+    report(pages[i].name, &pages[i].page, iterations, true);
+    report(pages[i].name, &pages[i].page, iterations, false);
+    page_free(&pages[i].page);
+  }
+  return 0;
+}
@@ -0,0 +1,159 @@
+// Synthetic JSP pages shared by the benchmarks in this directory.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  char *contents;
+  size_t size;
+  size_t capacity;
+} Page;
+
+static inline void page_append(Page *page, const char *format, ...) {
+  va_list args;
+  for (;;) {
+    size_t available = page->capacity - page->size;
+    va_start(args, format);
+    int written = vsnprintf(page->contents + page->size, available, format,
+                            args);
+    va_end(args);
+    if (written >= 0 && (size_t)written < available) {
+      page->size += written;
+      return;
+    }
+    page->capacity = page->capacity ? page->capacity * 2 : 4096;
+    if (written >= 0 && page->capacity < page->size + written + 1) {
+      page->capacity = page->size + written + 1;
+    }
+    page->contents = realloc(page->contents, page->capacity);
+  }
+}
+
+static inline void page_free(Page *page) {
+  free(page->contents);
+  *page = (Page){0};
+}
+
+static inline Page page_read(const char *path) {
+  Page page = {0};
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+  fseek(file, 0, SEEK_END);
+  page.size = ftell(file);
+  page.capacity = page.size + 1;
+  rewind(file);
+  page.contents = malloc(page.capacity);
+  if (fread(page.contents, 1, page.size, file) != page.size) {
+    perror(path);
+    exit(1);
+  }
+  page.contents[page.size] = '\0';
+  fclose(file);
+  return page;
+}
+
+// A div/span/td-heavy page: a layout shell around a large data table.
+static inline Page page_table(unsigned rows) {
+  Page page = {0};
+  page_append(&page, "<%%@ page contentType=\"text/html\" %%>\n"
+                     "<html>\n<head>\n  <title>Report</title>\n</head>\n"
+                     "<body>\n  <div class=\"content\">\n    <table>\n");
+  for (unsigned i = 0; i < rows; i++) {
+    page_append(&page,
+                "      <tr class=\"row\">\n"
+                "        <td><span class=\"id\">%u</span></td>\n"
+                "        <td><div class=\"name\">${row.name}</div></td>\n"
+                "        <td><span>${row.total}</span> items</td>\n"
+                "      </tr>\n",
+                i);
+  }
+  page_append(&page, "    </table>\n  </div>\n</body>\n</html>\n");
+  return page;
+}
+
+// A taglib-heavy page: c:, fmt: and custom tags nested a few levels deep.
+static inline Page page_taglib(unsigned items) {
+  Page page = {0};
+  page_append(&page,
+              "<%%@ taglib prefix=\"c\" uri=\"http://java.sun.com/jsp/jstl/core\" %%>\n"
+              "<%%@ taglib prefix=\"fmt\" uri=\"http://java.sun.com/jsp/jstl/fmt\" %%>\n"
+              "<div class=\"list\">\n");
+  for (unsigned i = 0; i < items; i++) {
+    page_append(&page,
+                "  <c:forEach items=\"${group%u.items}\" var=\"item\">\n"
+                "    <c:if test=\"${item.visible}\">\n"
+                "      <c:choose>\n"
+                "        <c:when test=\"${item.price > 0}\">\n"
+                "          <fmt:formatNumber value=\"${item.price}\" />\n"
+                "        </c:when>\n"
+                "        <c:otherwise><fmt:message key=\"free\" /></c:otherwise>\n"
+                "      </c:choose>\n"
+                "      <m:include component=\"${item.view}\" />\n"
+                "    </c:if>\n"
+                "  </c:forEach>\n",
+                i);
+  }
+  page_append(&page, "</div>\n");
+  return page;
+}
+
+// A page with one large inline script bundle of roughly `bytes` bytes. The
+// body is full of '<' comparisons and closing tags in strings, which are
+// partial matches of the </script terminator.
+static inline Page page_inline_script(size_t bytes) {
+  Page page = {0};
+  page_append(&page, "<html>\n<body>\n<script type=\"text/javascript\">\n");
+  for (unsigned i = 0; page.size < bytes; i++) {
+    page_append(&page,
+                "function render%u(rows) {\n"
+                "  var html = '<table>';\n"
+                "  for (var i = 0; i < rows.length; i++) {\n"
+                "    if (rows[i].depth <<1 < limit) html += '<tr><td>' + "
+                "rows[i].name + '</td></tr>';\n"
+                "  }\n"
+                "  return html + '</table><' + '/scr' + 'ipt>';\n"
+                "}\n",
+                i);
+  }
+  page_append(&page, "</script>\n</body>\n</html>\n");
+  return page;
+}
+
+// A page whose content sits `depth` elements deep, cycling through taglib
+// and HTML wrappers, with `items` leaf blocks at the bottom.
+static inline Page page_nested(unsigned depth, unsigned items) {
+  static const char *const wrappers[] = {
+      "c:forEach items=\"${level.children}\" var=\"level\"",
+      "c:if test=\"${level.visible}\"",
+      "div class=\"level\"",
+      "fmt:bundle basename=\"messages\"",
+      "m:panel title=\"${level.title}\"",
+      "section",
+  };
+  const unsigned wrapper_count = sizeof(wrappers) / sizeof(wrappers[0]);
+
+  Page page = {0};
+  page_append(&page,
+              "<%%@ taglib prefix=\"c\" uri=\"http://java.sun.com/jsp/jstl/core\" %%>\n"
+              "<%%@ taglib prefix=\"fmt\" uri=\"http://java.sun.com/jsp/jstl/fmt\" %%>\n");
+  for (unsigned i = 0; i < depth; i++) {
+    page_append(&page, "%*s<%s>\n", i, "", wrappers[i % wrapper_count]);
+  }
+  for (unsigned i = 0; i < items; i++) {
+    page_append(&page,
+                "%*s<c:out value=\"${level.name}\" /> <span>${level.count}</span>\n"
+                "%*s<m:include component=\"${level.view%u}\" />\n",
+                depth, "", depth, "", i);
+  }
+  for (unsigned i = depth; i-- > 0;) {
+    const char *wrapper = wrappers[i % wrapper_count];
+    page_append(&page, "%*s</%.*s>\n", i, "", (int)strcspn(wrapper, " "),
+                wrapper);
+  }
+  return page;
+}
@@ -0,0 +1,88 @@
+// Measures what the first lines of a page cost to parse: a doctype, an XML
+// declaration or a CDATA section in front of an otherwise ordinary page.
+//
+//   cc -O2 -Isrc bench/prologue.c src/parser.c -ltree-sitter -o prologue
+//   ./prologue [iterations]
+//
+// Each prologue is compared with the same page without it. A prologue the
+// grammar does not know sends the parser into error recovery at the top of
+// the page, which shows up as an ERROR node, extra scanner calls and extra
+// time per parse.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <tree_sitter/api.h>
+
+#define tree_sitter_jsp_external_scanner_scan scanner_scan_entry
+#include "../src/scanner.c"
+#undef tree_sitter_jsp_external_scanner_scan
+
+#include <time.h>
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+static unsigned long scan_calls;
+
+bool tree_sitter_jsp_external_scanner_scan(void *payload, TSLexer *lexer,
+                                           const bool *valid_symbols) {
+  scan_calls++;
+  return scanner_scan_entry(payload, lexer, valid_symbols);
+}
+
+static const char *const PROLOGUES[][2] = {
+    {"none", ""},
+    {"html5 doctype", "<!DOCTYPE html>\n"},
+    {"xhtml doctype",
+     "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\"\n"
+     "  \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">\n"},
+    {"xml declaration", "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"},
+    {"cdata", "<div><![CDATA[ if (a < b && c) { } ]]></div>\n"},
+};
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  unsigned iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+  Page body = page_table(20);
+
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+
+  printf("%-16s %6s %12s %12s %10s\n", "prologue", "error", "calls/parse",
+         "us/parse", "extra us");
+  double baseline = 0;
+  for (unsigned i = 0; i < sizeof(PROLOGUES) / sizeof(PROLOGUES[0]); i++) {
+    Page page = {0};
+    page_append(&page, "%s%s", PROLOGUES[i][1], body.contents);
+
+    TSTree *tree =
+        ts_parser_parse_string(parser, NULL, page.contents, page.size);
+    bool has_error = ts_node_has_error(ts_tree_root_node(tree));
+    ts_tree_delete(tree);
+
+    scan_calls = 0;
+    double start = now();
+    for (unsigned j = 0; j < iterations; j++) {
+      tree = ts_parser_parse_string(parser, NULL, page.contents, page.size);
+      ts_tree_delete(tree);
+    }
+    double us = (now() - start) / 1e3 / iterations;
+    if (i == 0)
+      baseline = us;
+
+    printf("%-16s %6s %12.1f %12.2f %10.2f\n", PROLOGUES[i][0],
+           has_error ? "yes" : "no", (double)scan_calls / iterations, us,
+           us - baseline);
+    page_free(&page);
+  }
+
+  ts_parser_delete(parser);
+  page_free(&body);
+  return 0;
+}
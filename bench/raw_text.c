@@ -0,0 +1,42 @@
+// Measures parse throughput on pages dominated by a large inline script.
+//
+//   cc -O2 -Isrc bench/raw_text.c src/parser.c src/scanner.c -ltree-sitter \
+//     -o raw_text
+//   ./raw_text [megabytes]
+
+#include <tree_sitter/api.h>
+
+#include <time.h>
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+int main(int argc, char **argv) {
+  size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+  Page page = page_inline_script(megabytes << 20);
+
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+
+  const unsigned iterations = 5;
+  clock_t start = clock();
+  for (unsigned i = 0; i < iterations; i++) {
+    TSTree *tree =
+        ts_parser_parse_string(parser, NULL, page.contents, page.size);
+    if (ts_node_has_error(ts_tree_root_node(tree))) {
+      fprintf(stderr, "unexpected parse error\n");
+      return 1;
+    }
+    ts_tree_delete(tree);
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC / iterations;
+
+  printf("%.1f MB inline script: %.2f ms/parse, %.1f MB/s\n",
+         page.size / 1048576.0, seconds * 1000,
+         page.size / 1048576.0 / seconds);
+
+  ts_parser_delete(parser);
+  page_free(&page);
+  return 0;
+}
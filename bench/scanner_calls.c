@@ -0,0 +1,56 @@
+// Counts external scanner calls per KB of input and how many of them are
+// answered by the first-character rejection of the scan mode. The counters
+// are in the scanner itself, compiled in by JSP_SCANNER_STATS.
+//
+//   cc -O2 -Isrc bench/scanner_calls.c src/parser.c -ltree-sitter \
+//     -o scanner_calls
+//   ./scanner_calls [page.jsp ...]
+//
+// Without arguments, synthetic table-heavy and taglib-heavy pages are used.
+
+#include <tree_sitter/api.h>
+
+#define JSP_SCANNER_STATS
+#include "../src/scanner.c"
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+static void report(const char *name, const Page *page) {
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+
+  scanner_stat_calls = 0;
+  scanner_stat_fast_rejections = 0;
+  TSTree *tree =
+      ts_parser_parse_string(parser, NULL, page->contents, page->size);
+  double kb = page->size / 1024.0;
+  printf("%-24s %8.1f KB %10.1f calls/KB %10.1f rejected/KB (%.1f%%)\n", name,
+         kb, scanner_stat_calls / kb, scanner_stat_fast_rejections / kb,
+         scanner_stat_calls
+             ? 100.0 * scanner_stat_fast_rejections / scanner_stat_calls
+             : 0.0);
+
+  ts_tree_delete(tree);
+  ts_parser_delete(parser);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      Page page = page_read(argv[i]);
+      report(argv[i], &page);
+      page_free(&page);
+    }
+    return 0;
+  }
+
+  Page table = page_table(2000);
+  Page taglib = page_taglib(1000);
+  report("table", &table);
+  report("taglib", &taglib);
+  page_free(&table);
+  page_free(&taglib);
+  return 0;
+}
@@ -0,0 +1,93 @@
+// Measures the time spent in the external scanner's serialize function per
+// external token.
+//
+//   cc -O2 -Isrc bench/serialize.c src/parser.c -ltree-sitter -o serialize
+//   ./serialize [page.jsp ...]
+//
+// Without arguments, synthetic taglib-heavy pages nested 30, 60 and 120
+// levels deep are used.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <tree_sitter/api.h>
+
+#include <time.h>
+
+#define tree_sitter_jsp_external_scanner_serialize scanner_serialize_entry
+#include "../src/scanner.c"
+#undef tree_sitter_jsp_external_scanner_serialize
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+static unsigned long serialize_calls;
+static double serialize_ns;
+
+static double now_ns(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+unsigned tree_sitter_jsp_external_scanner_serialize(void *payload,
+                                                    char *buffer) {
+  double start = now_ns();
+  unsigned length = scanner_serialize_entry(payload, buffer);
+  serialize_ns += now_ns() - start;
+  serialize_calls++;
+  return length;
+}
+
+// The cost of reading the clock twice, subtracted from every call.
+static double clock_overhead_ns(void) {
+  const unsigned samples = 1000000;
+  double total = 0;
+  for (unsigned i = 0; i < samples; i++) {
+    double start = now_ns();
+    total += now_ns() - start;
+  }
+  return total / samples;
+}
+
+static void report(const char *name, const Page *page, double overhead) {
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+
+  double best = 0;
+  for (int run = 0; run < 5; run++) {
+    serialize_calls = 0;
+    serialize_ns = 0;
+    TSTree *tree =
+        ts_parser_parse_string(parser, NULL, page->contents, page->size);
+    ts_tree_delete(tree);
+    double per_call = serialize_ns / serialize_calls - overhead;
+    if (run == 0 || per_call < best)
+      best = per_call;
+  }
+  printf("%-24s %8lu calls %8.1f ns/serialize\n", name, serialize_calls, best);
+
+  ts_parser_delete(parser);
+}
+
+int main(int argc, char **argv) {
+  double overhead = clock_overhead_ns();
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      Page page = page_read(argv[i]);
+      report(argv[i], &page, overhead);
+      page_free(&page);
+    }
+    return 0;
+  }
+
+  const unsigned depths[] = {30, 60, 120};
+  for (unsigned i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "nested-%u", depths[i]);
+    Page page = page_nested(depths[i], 500);
+    report(name, &page, overhead);
+    page_free(&page);
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+// Measures the serialized scanner state per external token, and checks that
+// each state deserializes back to the tag stack it was written from.
+//
+//   cc -O2 -Isrc bench/state_size.c src/parser.c -ltree-sitter -o state_size
+//   ./state_size [page.jsp ...]
+//
+// Without arguments, synthetic taglib-heavy pages nested 8, 40 and 200
+// levels deep and a shallow taglib page are used.
+
+#include <tree_sitter/api.h>
+
+#define tree_sitter_jsp_external_scanner_serialize scanner_serialize_entry
+#include "../src/scanner.c"
+#undef tree_sitter_jsp_external_scanner_serialize
+
+#include "pages.h"
+
+const TSLanguage *tree_sitter_jsp(void);
+
+static unsigned long states;
+static unsigned long long state_bytes;
+static unsigned max_state_bytes;
+static unsigned long lossy_states;
+static Scanner *replica;
+
+static bool tags_match(const Scanner *a, const Tag *tag_a, const Scanner *b,
+                       const Tag *tag_b) {
+  if (tag_a->type != tag_b->type)
+    return false;
+  if (tag_a->type != CUSTOM)
+    return true;
+  unsigned length_a, length_b;
+  const char *name_a = tag_names_get(&a->names, tag_a->name_id, &length_a);
+  const char *name_b = tag_names_get(&b->names, tag_b->name_id, &length_b);
+  return length_a == length_b && memcmp(name_a, name_b, length_a) == 0;
+}
+
+unsigned tree_sitter_jsp_external_scanner_serialize(void *payload,
+                                                    char *buffer) {
+  unsigned length = scanner_serialize_entry(payload, buffer);
+  states++;
+  state_bytes += length;
+  if (length > max_state_bytes)
+    max_state_bytes = length;
+
+  const Scanner *scanner = (const Scanner *)payload;
+  scanner_deserialize(replica, buffer, length);
+  bool lossless = replica->tags.size == scanner->tags.size;
+  for (uint32_t i = 0; lossless && i < scanner->tags.size; i++) {
+    lossless = tags_match(scanner, &scanner->tags.contents[i], replica,
+                          &replica->tags.contents[i]);
+  }
+  if (!lossless)
+    lossy_states++;
+  return length;
+}
+
+static void report(const char *name, const Page *page) {
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_jsp());
+
+  states = 0;
+  state_bytes = 0;
+  max_state_bytes = 0;
+  lossy_states = 0;
+  TSTree *tree =
+      ts_parser_parse_string(parser, NULL, page->contents, page->size);
+  printf("%-24s %8lu states %8.1f bytes/state %6u max %8lu lossy\n", name,
+         states, states ? (double)state_bytes / states : 0.0, max_state_bytes,
+         lossy_states);
+
+  ts_tree_delete(tree);
+  ts_parser_delete(parser);
+}
+
+int main(int argc, char **argv) {
+  replica = scanner_new();
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      Page page = page_read(argv[i]);
+      report(argv[i], &page);
+      page_free(&page);
+    }
+  } else {
+    const unsigned depths[] = {8, 40, 200};
+    for (unsigned i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+      char name[32];
+      snprintf(name, sizeof(name), "nested-%u", depths[i]);
+      Page page = page_nested(depths[i], 200);
+      report(name, &page);
+      page_free(&page);
+    }
+    Page taglib = page_taglib(1000);
+    report("taglib", &taglib);
+    page_free(&taglib);
+  }
+  scanner_delete(replica);
+  return 0;
+}
@@ -0,0 +1,67 @@
+// A TSLexer over an in-memory byte string, for benchmarks that drive the
+// external scanner directly. Bytes are passed through as code points, which
+// is enough for the ASCII pages in pages.h. Include after src/scanner.c.
+
+typedef struct {
+  TSLexer lexer;
+  const char *input;
+  size_t size;
+  size_t position;
+  size_t end;
+} StringLexer;
+
+static void string_lexer_advance(TSLexer *self, bool skip) {
+  StringLexer *lexer = (StringLexer *)self;
+  (void)skip;
+  if (lexer->position < lexer->size)
+    lexer->position++;
+  self->lookahead = lexer->position < lexer->size
+                        ? (unsigned char)lexer->input[lexer->position]
+                        : 0;
+}
+
+static void string_lexer_mark_end(TSLexer *self) {
+  StringLexer *lexer = (StringLexer *)self;
+  lexer->end = lexer->position;
+}
+
+static uint32_t string_lexer_get_column(TSLexer *self) {
+  (void)self;
+  return 0;
+}
+
+static bool string_lexer_is_at_included_range_start(const TSLexer *self) {
+  (void)self;
+  return false;
+}
+
+static bool string_lexer_eof(const TSLexer *self) {
+  const StringLexer *lexer = (const StringLexer *)self;
+  return lexer->position >= lexer->size;
+}
+
+static StringLexer string_lexer_new(const char *input, size_t size) {
+  StringLexer lexer = {
+      .lexer =
+          {
+              .advance = string_lexer_advance,
+              .mark_end = string_lexer_mark_end,
+              .get_column = string_lexer_get_column,
+              .is_at_included_range_start =
+                  string_lexer_is_at_included_range_start,
+              .eof = string_lexer_eof,
+          },
+      .input = input,
+      .size = size,
+  };
+  return lexer;
+}
+
+// Moves to `position`, as tree-sitter does before each scan. Like
+// tree-sitter, a token that never calls mark_end ends at the current
+// position, so `end` starts out there.
+static void string_lexer_reset(StringLexer *lexer, size_t position) {
+  lexer->position = lexer->end = position;
+  lexer->lexer.lookahead =
+      position < lexer->size ? (unsigned char)lexer->input[position] : 0;
+}
@@ -0,0 +1,108 @@
+// Compares tag_type_for_name with the linear scan over TAG_TYPES_BY_TAG_NAME
+// it replaced, on the tag-name mix of table-heavy and taglib-heavy pages.
+//
+//   cc -O2 -Isrc bench/tag_lookup.c -o tag_lookup
+//   ./tag_lookup
+
+#include "../src/tag.h"
+
+#include <stdio.h>
+#include <time.h>
+
+static TagType linear_tag_type_for_name(const char *name, unsigned length) {
+  for (int i = 0; i < 126; i++) {
+    const TagMapEntry *entry = &TAG_TYPES_BY_TAG_NAME[i];
+    if (strlen(entry->tag_name) == length &&
+        memcmp(name, entry->tag_name, length) == 0) {
+      return entry->tag_type;
+    }
+  }
+  return CUSTOM;
+}
+
+typedef struct {
+  const char *name;
+  unsigned weight;
+} WeightedName;
+
+// Relative frequencies of upper-cased start and end tag names.
+static const WeightedName TABLE_PAGE[] = {
+    {"TD", 40}, {"TR", 12}, {"DIV", 20}, {"SPAN", 24}, {"A", 6},
+    {"TABLE", 1}, {"TH", 2}, {"TBODY", 1}, {"IMG", 2}, {"INPUT", 2},
+    {"P", 3}, {"LI", 4}, {"UL", 1}, {"OPTION", 3}, {"BR", 2},
+};
+
+static const WeightedName TAGLIB_PAGE[] = {
+    {"C:IF", 20}, {"C:FOREACH", 10}, {"C:CHOOSE", 4}, {"C:WHEN", 8},
+    {"C:OTHERWISE", 4}, {"C:OUT", 12}, {"C:SET", 6}, {"FMT:MESSAGE", 14},
+    {"FMT:FORMATNUMBER", 4}, {"M:INCLUDE", 8}, {"DIV", 10}, {"SPAN", 6},
+    {"TD", 4},
+};
+
+static unsigned build_sequence(const WeightedName *names, unsigned count,
+                               const char **sequence) {
+  unsigned size = 0;
+  for (unsigned i = 0; i < count; i++) {
+    for (unsigned j = 0; j < names[i].weight; j++) {
+      sequence[size++] = names[i].name;
+    }
+  }
+  // Interleave names deterministically instead of running them in blocks.
+  for (unsigned i = size - 1; i > 0; i--) {
+    unsigned j = (i * 2654435761u) % (i + 1);
+    const char *swap = sequence[i];
+    sequence[i] = sequence[j];
+    sequence[j] = swap;
+  }
+  return size;
+}
+
+static double run(TagType (*lookup)(const char *, unsigned),
+                  const char **sequence, unsigned size, unsigned rounds,
+                  unsigned *checksum) {
+  unsigned lengths[512];
+  for (unsigned i = 0; i < size; i++) {
+    lengths[i] = strlen(sequence[i]);
+  }
+  clock_t start = clock();
+  for (unsigned round = 0; round < rounds; round++) {
+    for (unsigned i = 0; i < size; i++) {
+      *checksum += lookup(sequence[i], lengths[i]);
+    }
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / (rounds * size);
+}
+
+static void compare(const char *label, const WeightedName *names,
+                    unsigned count) {
+  const char *sequence[512];
+  unsigned size = build_sequence(names, count, sequence);
+  unsigned rounds = 200000;
+  unsigned linear_checksum = 0, hashed_checksum = 0;
+  double linear =
+      run(linear_tag_type_for_name, sequence, size, rounds, &linear_checksum);
+  double hashed =
+      run(tag_type_for_name, sequence, size, rounds, &hashed_checksum);
+  if (linear_checksum != hashed_checksum) {
+    fprintf(stderr, "%s: lookups disagree\n", label);
+    exit(1);
+  }
+  printf("%-8s linear %6.2f ns/lookup   perfect hash %6.2f ns/lookup\n",
+         label, linear, hashed);
+}
+
+int main(void) {
+  for (int i = 0; i < 126; i++) {
+    const TagMapEntry *entry = &TAG_TYPES_BY_TAG_NAME[i];
+    if (tag_type_for_name(entry->tag_name, strlen(entry->tag_name)) !=
+        entry->tag_type) {
+      fprintf(stderr, "%s is not in the perfect hash table\n",
+              entry->tag_name);
+      return 1;
+    }
+  }
+
+  compare("table", TABLE_PAGE, sizeof(TABLE_PAGE) / sizeof(TABLE_PAGE[0]));
+  compare("taglib", TAGLIB_PAGE, sizeof(TAGLIB_PAGE) / sizeof(TAGLIB_PAGE[0]));
+  return 0;
+}
@@ -0,0 +1,85 @@
+// Measures how fast the scanner reads template text with braces in it, as
+// in pages that show JSON or code samples.
+//
+//   cc -O2 -Isrc bench/text.c -o text
+//   ./text [megabytes]
+//
+// The scanner is driven directly with the valid symbols of element content.
+// Each scan resumes after the token it produced; the markup and EL in the
+// page are skipped by the driver, so only text scanning is timed.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "../src/scanner.c"
+
+#include <time.h>
+
+#include "pages.h"
+#include "string_lexer.h"
+
+static Page page_braces(size_t bytes) {
+  Page page = {0};
+  for (unsigned i = 0; page.size < bytes; i++) {
+    page_append(&page,
+                "<p>Request %u: {\"id\": %u, \"tags\": {\"a\": [1, 2]}} "
+                "returns {ok} for ${user.name} and {{ %u }}.</p>\n",
+                i, i, i);
+  }
+  return page;
+}
+
+int main(int argc, char **argv) {
+  size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+  Page page = page_braces(megabytes << 20);
+
+  bool valid_symbols[TOKEN_TYPE_COUNT] = {0};
+  valid_symbols[TEXT_FRAGMENT] = true;
+  valid_symbols[EL_EXPRESSION_START] = true;
+  valid_symbols[JSP_SCRIPTLET_START] = true;
+  valid_symbols[JSP_EXPRESSION_START] = true;
+  valid_symbols[JSP_DECLARATION_START] = true;
+  valid_symbols[JSP_COMMENT] = true;
+  valid_symbols[JSP_DIRECTIVE_START] = true;
+  valid_symbols[IMPLICIT_END_TAG] = true;
+
+  StringLexer lexer = string_lexer_new(page.contents, page.size);
+  void *scanner = tree_sitter_jsp_external_scanner_create();
+
+  const unsigned iterations = 5;
+  size_t tokens = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned i = 0; i < iterations; i++) {
+    size_t position = 0;
+    while (position < page.size) {
+      if (page.contents[position] == '<') {
+        position = strchr(&page.contents[position], '>') - page.contents + 1;
+        continue;
+      }
+      string_lexer_reset(&lexer, position);
+      if (tree_sitter_jsp_external_scanner_scan(scanner, &lexer.lexer,
+                                                valid_symbols) &&
+          lexer.end > position) {
+        if (lexer.lexer.result_symbol == EL_EXPRESSION_START) {
+          lexer.end =
+              strchr(&page.contents[lexer.end], '}') - page.contents + 1;
+        }
+        position = lexer.end;
+        tokens++;
+      } else {
+        position++;
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  printf("%.1f MB of text with braces: %.1f MB/s, %.1f tokens/KB\n",
+         page.size / 1048576.0, page.size / 1048576.0 * iterations / seconds,
+         tokens / iterations / (page.size / 1024.0));
+
+  tree_sitter_jsp_external_scanner_destroy(scanner);
+  page_free(&page);
+  return 0;
+}
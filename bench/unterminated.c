@@ -0,0 +1,81 @@
+// Checks that the scanner's cost stays linear in the page size when a page
+// contains constructs whose closer never comes: comments, JSP comments,
+// scriptlets and EL expressions.
+//
+//   cc -O2 -Isrc bench/unterminated.c -o unterminated
+//   ./unterminated
+//
+// The scanner is driven directly, the way a parser in error recovery would
+// drive it: a successful scan resumes after its token, and a failed scan
+// resumes one character later. A flat ns/byte column across sizes means
+// linear scaling.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "../src/scanner.c"
+
+#include <time.h>
+
+#include "pages.h"
+#include "string_lexer.h"
+
+// Returns the time taken to scan the whole page, in nanoseconds.
+static double scan_page(const Page *page) {
+  bool valid_symbols[TOKEN_TYPE_COUNT];
+  for (unsigned i = 0; i < TOKEN_TYPE_COUNT; i++) {
+    valid_symbols[i] = true;
+  }
+
+  StringLexer lexer = string_lexer_new(page->contents, page->size);
+  void *scanner = tree_sitter_jsp_external_scanner_create();
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  size_t resume = 0;
+  while (resume < page->size) {
+    string_lexer_reset(&lexer, resume);
+    if (tree_sitter_jsp_external_scanner_scan(scanner, &lexer.lexer,
+                                              valid_symbols) &&
+        lexer.end > resume) {
+      resume = lexer.end;
+    } else {
+      resume++;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  tree_sitter_jsp_external_scanner_destroy(scanner);
+  return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+// A list page of roughly `bytes` bytes in which every 32nd line opens
+// `construct` without ever closing it.
+static Page page_unterminated(const char *construct, size_t bytes) {
+  Page page = {0};
+  page_append(&page, "<ul>\n");
+  for (unsigned i = 0; page.size < bytes; i++) {
+    if (i % 32 == 0) {
+      page_append(&page, "  <li>item %u %s note\n", i, construct);
+    } else {
+      page_append(&page, "  <li class=\"item\">item %u</li>\n", i);
+    }
+  }
+  return page;
+}
+
+int main(void) {
+  const char *constructs[] = {"<!--", "<%--", "<%", "${"};
+  const size_t sizes[] = {256 << 10, 512 << 10, 1 << 20, 2 << 20};
+
+  for (unsigned i = 0; i < sizeof(constructs) / sizeof(constructs[0]); i++) {
+    printf("%-6s", constructs[i]);
+    for (unsigned j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+      Page page = page_unterminated(constructs[i], sizes[j]);
+      double ns = scan_page(&page);
+      printf(" %5zu KB %8.2f ns/byte", sizes[j] >> 10, ns / page.size);
+      page_free(&page);
+    }
+    printf("\n");
+  }
+  return 0;
+}
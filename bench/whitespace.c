@@ -0,0 +1,133 @@
+// Counts how many times each whitespace byte between tokens is read on an
+// indentation-heavy page.
+//
+//   cc -O2 -Isrc bench/whitespace.c -o whitespace
+//   ./whitespace
+//
+// The scanner is called at the start of every run of whitespace, with the
+// valid symbols of the place the run is in: between attributes, inside an EL
+// expression, or in element content. When the scan does not consume the run,
+// the generated lexer reads it again, and those reads are counted too.
+
+#include "../src/scanner.c"
+
+#include "pages.h"
+#include "string_lexer.h"
+
+static unsigned long whitespace_reads;
+
+static void counting_advance(TSLexer *self, bool skip) {
+  if (char_is_space(self->lookahead))
+    whitespace_reads++;
+  string_lexer_advance(self, skip);
+}
+
+// Rows nested `depth` levels deep, indented by two spaces per level, with
+// several attributes per tag and EL expressions written with spaces.
+static Page page_indented(unsigned depth, unsigned rows) {
+  Page page = {0};
+  for (unsigned i = 0; i < depth; i++) {
+    page_append(&page, "%*s<div class=\"level\">\n", 2 * i, "");
+  }
+  for (unsigned i = 0; i < rows; i++) {
+    unsigned indent = 2 * depth;
+    page_append(&page,
+                "%*s<tr class=\"row\" id=\"row%u\"\n"
+                "%*s    data-depth=\"${ row.depth + 1 }\">\n"
+                "%*s  <td>${ row.name }</td>\n"
+                "%*s  <td>${ row.total * 2 } of ${ row.max }</td>\n"
+                "%*s</tr>\n",
+                indent, "", i, indent, "", indent, "", indent, "", indent, "");
+  }
+  for (unsigned i = depth; i-- > 0;) {
+    page_append(&page, "%*s</div>\n", 2 * i, "");
+  }
+  return page;
+}
+
+enum { IN_CONTENT, IN_TAG, IN_EL, PLACE_COUNT };
+
+static const char *const PLACE_NAMES[] = {"content", "tag", "el"};
+
+static void valid_symbols_for(unsigned place, bool *valid) {
+  memset(valid, 0, TOKEN_TYPE_COUNT * sizeof(bool));
+  valid[JSP_SCRIPTLET_START] = valid[JSP_EXPRESSION_START] =
+      valid[JSP_DECLARATION_START] = valid[JSP_COMMENT] = true;
+  valid[WHITESPACE] = true;
+  switch (place) {
+  case IN_CONTENT:
+    valid[TEXT_FRAGMENT] = valid[EL_EXPRESSION_START] = true;
+    valid[IMPLICIT_END_TAG] = true;
+    break;
+  case IN_TAG:
+    valid[SELF_CLOSING_TAG_DELIMITER] = true;
+    break;
+  }
+}
+
+// Returns the whitespace reads per whitespace byte in each place.
+static void count_reads(const Page *page, double *reads_per_byte) {
+  void *scanner = tree_sitter_jsp_external_scanner_create();
+  StringLexer lexer = string_lexer_new(page->contents, page->size);
+  lexer.lexer.advance = counting_advance;
+
+  unsigned long reads[PLACE_COUNT] = {0}, bytes[PLACE_COUNT] = {0};
+  unsigned place = IN_CONTENT;
+  bool valid[TOKEN_TYPE_COUNT];
+  for (size_t i = 0; i < page->size;) {
+    char c = page->contents[i];
+    if (!char_is_space((unsigned char)c)) {
+      if (place == IN_CONTENT && c == '<') {
+        place = IN_TAG;
+      } else if (place == IN_TAG && c == '>') {
+        place = IN_CONTENT;
+      } else if (c == '$' && page->contents[i + 1] == '{') {
+        place = place == IN_TAG ? IN_TAG : IN_EL;
+      } else if (place == IN_EL && c == '}') {
+        place = IN_CONTENT;
+      }
+      i++;
+      continue;
+    }
+
+    size_t run = strspn(&page->contents[i], " \t\r\n");
+    valid_symbols_for(place, valid);
+    whitespace_reads = 0;
+    string_lexer_reset(&lexer, i);
+    if (!tree_sitter_jsp_external_scanner_scan(scanner, &lexer.lexer, valid) ||
+        lexer.end == i)
+      whitespace_reads += run;
+    reads[place] += whitespace_reads;
+    bytes[place] += run;
+    i += run;
+  }
+
+  for (unsigned place = 0; place < PLACE_COUNT; place++) {
+    reads_per_byte[place] = bytes[place] ? (double)reads[place] / bytes[place] : 0;
+  }
+  tree_sitter_jsp_external_scanner_destroy(scanner);
+}
+
+int main(void) {
+  Page page = page_indented(16, 5000);
+
+  printf("%-26s", "whitespace text");
+  for (unsigned place = 0; place < PLACE_COUNT; place++) {
+    printf(" %10s", PLACE_NAMES[place]);
+  }
+  printf("\n");
+
+  for (unsigned keep = 2; keep-- > 0;) {
+    tree_sitter_jsp_set_whitespace_text(keep);
+    double reads_per_byte[PLACE_COUNT];
+    count_reads(&page, reads_per_byte);
+    printf("%-26s", keep ? "kept (reads/byte)" : "skipped (reads/byte)");
+    for (unsigned place = 0; place < PLACE_COUNT; place++) {
+      printf(" %10.2f", reads_per_byte[place]);
+    }
+    printf("\n");
+  }
+
+  page_free(&page);
+  return 0;
+}
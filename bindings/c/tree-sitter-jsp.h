@@ -0,0 +1,46 @@
+#ifndef TREE_SITTER_JSP_H_
+#define TREE_SITTER_JSP_H_
+
+#include <stdbool.h>
+
+typedef struct TSLanguage TSLanguage;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const TSLanguage *tree_sitter_jsp(void);
+
+// Custom tags the scanner should treat specially. Names are matched
+// case-insensitively and must be custom (taglib) names made of tag name
+// characters, such as "fmt:setLocale"; HTML element names are rejected.
+//
+// The registry is process-wide and is copied by each parser when its scanner
+// is created, so register tags before creating parsers. It is guarded by a
+// lock, so these functions may be called while parsers are created on other
+// threads. A name registered twice takes the kind of the last call.
+
+// A tag that never has content, so `<fmt:setLocale value="fr">` is closed
+// implicitly like `<br>` instead of staying open to the end of the page.
+bool tree_sitter_jsp_register_void_tag(const char *name);
+
+// A tag whose body is not markup, such as `<sql:query>` or `<x:parse>`. Its
+// content up to the matching end tag is a single raw_text.
+bool tree_sitter_jsp_register_raw_text_tag(const char *name);
+
+// Forgets every registered tag. Scanners that already exist keep theirs.
+void tree_sitter_jsp_clear_registered_tags(void);
+
+// Whether template text that is only whitespace, such as the indentation
+// between tags, becomes a text node. It does by default. When turned off,
+// such runs are skipped like the whitespace inside tags, and other text nodes
+// start at their first non-space character. Like the tag registry, the
+// setting is process-wide, guarded by the same lock, and copied by each
+// scanner when it is created.
+void tree_sitter_jsp_set_whitespace_text(bool keep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TREE_SITTER_JSP_H_
@@ -1,15 +1,32 @@
+const EL_PREC = {
+  SEQUENCE: 1,
+  ASSIGNMENT: 2,
+  LAMBDA: 3,
+  TERNARY: 4,
+  OR: 5,
+  AND: 6,
+  EQUALITY: 7,
+  RELATIONAL: 8,
+  CONCAT: 9,
+  ADDITIVE: 10,
+  MULTIPLICATIVE: 11,
+  UNARY: 12,
+  MEMBER: 13,
+};
+
 module.exports = grammar({
   name: "jsp",
 
+  word: $ => $.identifier,
+
   externals: $ => [
-    $.jsp_scriptlet,
-    $.jsp_expression,
-    $._jsp_declaration,
+    $._jsp_scriptlet_start,
+    $._jsp_expression_start,
+    $._jsp_declaration_start,
     $._jsp_comment,
     $._jsp_directive_start,
-    $._el_expression,
+    $._el_expression_start,
     $._text_fragment,
-    $._interpolation_text,
     $._start_tag_name,
     $._template_start_tag_name,
     $._script_start_tag_name,
@@ -18,21 +35,47 @@ module.exports = grammar({
     $.erroneous_end_tag_name,
     "/>",
     $._implicit_end_tag,
-    $.raw_text,
-    $.comment,
+    $._raw_text_chunk,
+    $._comment,
+    $._java_content_chunk,
+    $._raw_text_start_tag_name,
+    $._comment_chunk,
+    $._comment_tail,
+    $._jsp_comment_chunk,
+    $._jsp_comment_tail,
+    $.doctype,
+    $.cdata_section,
+    $.processing_instruction,
+    $._whitespace,
+    $._taglib_start_tag_name,
+    $._tag_local_name,
+    $._double_quoted_attribute_text,
+    $._single_quoted_attribute_text,
   ],
 
+  // Whitespace is scanned by the external scanner, which has to look at it
+  // anyway, so the generated lexer never reads it a second time.
   extras: $ => [
-    /\s+/,
+    $._whitespace,
     $.jsp_scriptlet,
     $.jsp_expression,
     $.jsp_declaration,
     $.jsp_comment
   ],
 
+  conflicts: $ => [
+    // `fn:length(x)` against `a ? b : c` and `{a: b}`, decided at the `(`
+    [$._el_primary_expression, $.qualified_identifier],
+    // `(x)` as an expression against the parameters of `(x) -> x`, decided
+    // at the `->`
+    [$._el_primary_expression, $.lambda_parameters],
+  ],
+
   rules: {
     component: $ => repeat(
       choice(
+        $.doctype,
+        $.processing_instruction,
         $.comment,
         $.jsp_directive,
         $.jsp_scriptlet,
@@ -41,13 +84,18 @@ module.exports = grammar({
         $.jsp_comment,
         $.el_expression,
         $.element,
+        $.taglib_element,
         $.template_element,
         $.script_element,
         $.style_element,
+        $.raw_text_element,
       ),
     ),
 
     _node: $ => choice(
+      $.doctype,
+      $.cdata_section,
+      $.processing_instruction,
       $.comment,
       $.jsp_directive,
       $.jsp_scriptlet,
@@ -56,11 +104,12 @@ module.exports = grammar({
       $.jsp_comment,
       $.el_expression,
       $.text,
-      $.interpolation,
       $.element,
+      $.taglib_element,
       $.template_element,
       $.script_element,
       $.style_element,
+      $.raw_text_element,
       $.erroneous_end_tag,
     ),
 
@@ -74,6 +123,17 @@ module.exports = grammar({
       $.self_closing_tag,
     ),
 
+    // An element whose prefix was declared by a taglib directive earlier in
+    // the page, such as <c:forEach> after <%@ taglib prefix="c" ... %>
+    taglib_element: $ => choice(
+      seq(
+        alias($.taglib_start_tag, $.start_tag),
+        repeat($._node),
+        choice($.end_tag, $._implicit_end_tag),
+      ),
+      alias($.taglib_self_closing_tag, $.self_closing_tag),
+    ),
+
     template_element: $ => seq(
       alias($.template_start_tag, $.start_tag),
       repeat($._node),
@@ -82,19 +142,51 @@ module.exports = grammar({
 
     script_element: $ => seq(
       alias($.script_start_tag, $.start_tag),
-      optional($.raw_text),
+      repeat($._raw_text_node),
       $.end_tag,
     ),
 
     style_element: $ => seq(
       alias($.style_start_tag, $.start_tag),
-      optional($.raw_text),
+      repeat($._raw_text_node),
       $.end_tag,
     ),
 
+    // A custom tag registered with tree_sitter_jsp_register_raw_text_tag,
+    // whose body is not markup
+    raw_text_element: $ => choice(
+      seq(
+        alias($.raw_text_start_tag, $.start_tag),
+        repeat($._raw_text_node),
+        $.end_tag,
+      ),
+      alias($.raw_text_self_closing_tag, $.self_closing_tag),
+    ),
+
+    // JSP and EL in a raw text body are nodes of their own, so the raw text
+    // around them is only the script or style source.
+    _raw_text_node: $ => choice(
+      $.raw_text,
+      $.jsp_directive,
+      $.jsp_scriptlet,
+      $.jsp_expression,
+      $.jsp_declaration,
+      $.jsp_comment,
+      $.el_expression,
+    ),
+
+    // Long bodies come from the scanner in chunks, so that an edit only
+    // relexes the chunk around it; a short one is a single token.
+    raw_text: $ => prec.right(repeat1($._raw_text_chunk)),
+
+    comment: $ => choice(
+      $._comment,
+      seq(repeat1($._comment_chunk), $._comment_tail),
+    ),
+
     start_tag: $ => seq(
       "<",
-      alias($._start_tag_name, $.tag_name),
+      tagName($, $._start_tag_name, $._namespaced_start_tag_name),
       repeat($.attribute),
       ">",
     ),
@@ -120,16 +212,52 @@ module.exports = grammar({
       ">",
     ),
 
+    raw_text_start_tag: $ => seq(
+      "<",
+      tagName(
+        $,
+        $._raw_text_start_tag_name,
+        $._namespaced_raw_text_start_tag_name,
+      ),
+      repeat($.attribute),
+      ">",
+    ),
+
+    taglib_start_tag: $ => seq(
+      "<",
+      tagName($, $._taglib_start_tag_name, $._namespaced_taglib_start_tag_name),
+      repeat($.attribute),
+      ">",
+    ),
+
+    taglib_self_closing_tag: $ => seq(
+      "<",
+      tagName($, $._taglib_start_tag_name, $._namespaced_taglib_start_tag_name),
+      repeat($.attribute),
+      "/>",
+    ),
+
+    raw_text_self_closing_tag: $ => seq(
+      "<",
+      tagName(
+        $,
+        $._raw_text_start_tag_name,
+        $._namespaced_raw_text_start_tag_name,
+      ),
+      repeat($.attribute),
+      "/>",
+    ),
+
     self_closing_tag: $ => seq(
       "<",
-      alias($._start_tag_name, $.tag_name),
+      tagName($, $._start_tag_name, $._namespaced_start_tag_name),
       repeat($.attribute),
       "/>",
     ),
 
     end_tag: $ => seq(
       "</",
-      alias($._end_tag_name, $.tag_name),
+      tagName($, $._end_tag_name, $._namespaced_end_tag_name),
       ">",
     ),
 
@@ -139,6 +267,18 @@ module.exports = grammar({
       ">",
     ),
 
+    // Namespaced tag names, aliased to tag_name by the tags above, so queries
+    // can select them by structure
+    _namespaced_start_tag_name: $ => namespacedName($, $._start_tag_name),
+
+    _namespaced_raw_text_start_tag_name: $ =>
+      namespacedName($, $._raw_text_start_tag_name),
+
+    _namespaced_taglib_start_tag_name: $ =>
+      namespacedName($, $._taglib_start_tag_name),
+
+    _namespaced_end_tag_name: $ => namespacedName($, $._end_tag_name),
+
     attribute: $ => seq(
       $.attribute_name,
       optional(seq(
@@ -146,7 +286,8 @@ module.exports = grammar({
         choice(
           $.attribute_value,
           $.quoted_attribute_value,
-          $.el_expression
+          $.el_expression,
+          $.jsp_expression,
         ),
       )),
     ),
@@ -161,28 +302,29 @@ module.exports = grammar({
         seq('"', optional($._attribute_content_double), '"'),
       ),
 
-    // Attribute content can contain mixed text and EL expressions
+    // Attribute content can contain mixed text, EL expressions and JSP
+    // expressions or scriptlets. The scanner produces the text, which stops
+    // before "${", "#{" and "<%" and keeps its whitespace, as in
+    // class="row <%= cls %> active".
     _attribute_content_single: $ => repeat1(
       choice(
-        alias(/[^'$]+/, $.attribute_value),
+        alias($._single_quoted_attribute_text, $.attribute_value),
         $.el_expression,
+        $.jsp_expression,
+        $.jsp_scriptlet,
       )
     ),
 
     _attribute_content_double: $ => repeat1(
       choice(
-        alias(/[^"$]+/, $.attribute_value),
+        alias($._double_quoted_attribute_text, $.attribute_value),
         $.el_expression,
+        $.jsp_expression,
+        $.jsp_scriptlet,
       )
     ),
 
-    text: $ => choice($._text_fragment, "{{"),
-
-    interpolation: $ => seq(
-      "{{",
-      optional(alias($._interpolation_text, $.raw_text)),
-      "}}",
-    ),
+    text: $ => $._text_fragment,
 
     // JSP directive with simplified grammar reusing existing attribute rules
     jsp_directive: $ => seq(
@@ -194,13 +336,200 @@ module.exports = grammar({
 
     jsp_directive_name: _ => /page|taglib|include/,
 
+    // JSP scriptlet, expression and declaration. The scanner produces the
+    // opening delimiter and the Java code up to the closing %>.
+    jsp_scriptlet: $ => seq(
+      $._jsp_scriptlet_start,
+      optional($.java_content),
+      '%>'
+    ),
+
+    jsp_expression: $ => seq(
+      $._jsp_expression_start,
+      optional($.java_content),
+      '%>'
+    ),
+
     // JSP declaration for declaring variables and methods
-    jsp_declaration: $ => $._jsp_declaration,
+    jsp_declaration: $ => seq(
+      $._jsp_declaration_start,
+      optional($.java_content),
+      '%>'
+    ),
+
+    java_content: $ => repeat1($._java_content_chunk),
 
     // JSP comment (different from HTML comment)
-    jsp_comment: $ => $._jsp_comment,
+    jsp_comment: $ => choice(
+      $._jsp_comment,
+      seq(repeat1($._jsp_comment_chunk), $._jsp_comment_tail),
+    ),
+
+    // Expression Language for accessing data and functions. The scanner
+    // produces the opening "${" or "#{" without looking for the closing brace,
+    // so an unterminated expression is a parse error here.
+    el_expression: $ => seq(
+      $._el_expression_start,
+      optional($._el_expression),
+      '}',
+    ),
+
+    _el_expression: $ => choice(
+      $.sequence_expression,
+      $.assignment_expression,
+      $.lambda_expression,
+      $.ternary_expression,
+      $.binary_expression,
+      $.unary_expression,
+      $._el_primary_expression,
+    ),
+
+    _el_primary_expression: $ => choice(
+      $.identifier,
+      $.member_expression,
+      $.subscript_expression,
+      $.call_expression,
+      $.parenthesized_expression,
+      $.string,
+      $.number,
+      $.true,
+      $.false,
+      $.null,
+      $.list,
+      $.map,
+      $.set,
+    ),
+
+    // `a; b` evaluates both and has the value of `b`
+    sequence_expression: $ => prec.left(EL_PREC.SEQUENCE, seq(
+      field('left', $._el_expression),
+      ';',
+      field('right', $._el_expression),
+    )),
+
+    assignment_expression: $ => prec.right(EL_PREC.ASSIGNMENT, seq(
+      field('left', $._el_expression),
+      '=',
+      field('right', $._el_expression),
+    )),
+
+    lambda_expression: $ => prec.right(EL_PREC.LAMBDA, seq(
+      field('parameters', choice($.identifier, $.lambda_parameters)),
+      '->',
+      field('body', $._el_expression),
+    )),
+
+    lambda_parameters: $ => seq('(', commaSep($.identifier), ')'),
 
-    // Expression Language for accessing data and functions
-    el_expression: $ => $._el_expression,
+    ternary_expression: $ => prec.right(EL_PREC.TERNARY, seq(
+      field('condition', $._el_expression),
+      '?',
+      field('consequence', $._el_expression),
+      ':',
+      field('alternative', $._el_expression),
+    )),
+
+    binary_expression: $ => choice(
+      ...[
+        [choice('||', 'or'), EL_PREC.OR],
+        [choice('&&', 'and'), EL_PREC.AND],
+        [choice('==', '!=', 'eq', 'ne'), EL_PREC.EQUALITY],
+        [choice('<', '>', '<=', '>=', 'lt', 'gt', 'le', 'ge', 'instanceof'), EL_PREC.RELATIONAL],
+        ['+=', EL_PREC.CONCAT],
+        [choice('+', '-'), EL_PREC.ADDITIVE],
+        [choice('*', '/', '%', 'div', 'mod'), EL_PREC.MULTIPLICATIVE],
+      ].map(([operator, precedence]) => prec.left(precedence, seq(
+        field('left', $._el_expression),
+        field('operator', operator),
+        field('right', $._el_expression),
+      ))),
+    ),
+
+    unary_expression: $ => prec(EL_PREC.UNARY, seq(
+      field('operator', choice('-', '!', 'not', 'empty')),
+      field('argument', $._el_expression),
+    )),
+
+    member_expression: $ => prec(EL_PREC.MEMBER, seq(
+      field('object', $._el_primary_expression),
+      '.',
+      field('property', alias($.identifier, $.property_identifier)),
+    )),
+
+    subscript_expression: $ => prec(EL_PREC.MEMBER, seq(
+      field('object', $._el_primary_expression),
+      '[',
+      field('index', $._el_expression),
+      ']',
+    )),
+
+    call_expression: $ => prec(EL_PREC.MEMBER, seq(
+      field('function', choice($._el_primary_expression, $.qualified_identifier)),
+      field('arguments', $.arguments),
+    )),
+
+    // An EL function from a tag library, such as `fn:length`
+    qualified_identifier: $ => seq(
+      field('prefix', $.identifier),
+      ':',
+      field('name', $.identifier),
+    ),
+
+    arguments: $ => seq('(', commaSep($._el_expression), ')'),
+
+    parenthesized_expression: $ => seq('(', $._el_expression, ')'),
+
+    list: $ => seq('[', commaSep($._el_expression), ']'),
+
+    map: $ => seq('{', commaSep($.pair), '}'),
+
+    set: $ => seq('{', commaSep1($._el_expression), '}'),
+
+    pair: $ => seq(
+      field('key', $._el_expression),
+      ':',
+      field('value', $._el_expression),
+    ),
+
+    identifier: _ => /[a-zA-Z_$][a-zA-Z0-9_$]*/,
+
+    string: _ => choice(
+      /'([^'\\]|\\.)*'/,
+      /"([^"\\]|\\.)*"/,
+    ),
+
+    number: _ => /\d+(\.\d*)?([eE][+-]?\d+)?|\.\d+([eE][+-]?\d+)?/,
+
+    true: _ => 'true',
+
+    false: _ => 'false',
+
+    null: _ => 'null',
   },
 });
+
+function commaSep1(rule) {
+  return seq(rule, repeat(seq(',', rule)));
+}
+
+function commaSep(rule) {
+  return optional(commaSep1(rule));
+}
+
+// A tag name from the scanner, either a single token or the rule holding the
+// prefix and local name of a namespaced name such as c:forEach.
+function tagName($, name, namespaced) {
+  return choice(
+    alias(name, $.tag_name),
+    alias(namespaced, $.tag_name),
+  );
+}
+
+// The parts of a namespaced tag name. This has to be a rule of its own: an
+// alias on a seq is applied to each of its steps instead of making a node.
+function namespacedName($, name) {
+  return seq(
+    field('prefix', alias(name, $.namespace)),
+    field('local_name', alias($._tag_local_name, $.local_name)),
+  );
+}
@@ -8,10 +8,15 @@
 (comment) @comment
 (jsp_comment) @comment
 
+; Markup declarations
+(doctype) @constant
+(processing_instruction) @property
+(cdata_section) @text
+
 ; HTML Elements
 (tag_name) @tag
-((tag_name) @keyword
- (#match? @keyword ":"))
+(tag_name
+  prefix: (namespace)) @keyword
 
 (attribute_name) @attribute
 
@@ -30,5 +35,65 @@
 (text) @text
 (raw_text) @text
 
-; Interpolation
-(interpolation) @embedded
+; Expression Language
+(el_expression) @embedded
+
+(call_expression
+  function: (identifier) @function)
+(call_expression
+  function: (member_expression
+    property: (property_identifier) @function.method))
+(qualified_identifier
+  prefix: (identifier) @namespace
+  name: (identifier) @function)
+
+(lambda_parameters
+  (identifier) @variable.parameter)
+(lambda_expression
+  parameters: (identifier) @variable.parameter)
+
+(property_identifier) @property
+(identifier) @variable
+
+(string) @string
+(number) @number
+[
+  (true)
+  (false)
+] @boolean
+(null) @constant.builtin
+
+[
+  "and"
+  "or"
+  "not"
+  "empty"
+  "eq"
+  "ne"
+  "lt"
+  "gt"
+  "le"
+  "ge"
+  "div"
+  "mod"
+  "instanceof"
+] @keyword.operator
+
+[
+  "=="
+  "!="
+  "<="
+  ">="
+  "&&"
+  "||"
+  "!"
+  "+"
+  "-"
+  "*"
+  "%"
+  "+="
+  "?"
+  "="
+  "->"
+  ";"
+] @operator
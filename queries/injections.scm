@@ -1,26 +1,47 @@
 ; Java injection in JSP scriptlets - these contain Java code blocks
-((jsp_scriptlet) @injection.content
- (#set! injection.language "java"))
+(jsp_scriptlet
+  (java_content) @injection.content
+  (#set! injection.language "java"))
 
 ; Java injection in JSP expressions - these contain Java expressions
-((jsp_expression) @injection.content
- (#set! injection.language "java"))
+(jsp_expression
+  (java_content) @injection.content
+  (#set! injection.language "java"))
 
 ; Java injection in JSP declarations - these contain Java declarations (fields, methods)
-((jsp_declaration) @injection.content
- (#set! injection.language "java"))
-
-; Expression Language (EL) injection
-; EL is a simple expression language, we'll inject as Java for basic syntax highlighting
-; Individual editors can override this with EL-specific parsers if available
-((el_expression) @injection.content
- (#set! injection.language "java")
- (#set! injection.include-children))
+(jsp_declaration
+  (java_content) @injection.content
+  (#set! injection.language "java"))
 
+; Script and style bodies are split around JSP and EL, so their raw text is
+; injected combined. This merges every script on the page into one document,
+; and every style into another, rather than each element on its own. That is
+; intended: the scripts of a page share one global scope and its styles one
+; cascade, and queries cannot group the pieces by element.
 (style_element
     (raw_text) @injection.content
-    (#set! injection.language "html"))
+    (#set! injection.language "css")
+    (#set! injection.combined))
 
 (script_element
     (raw_text) @injection.content
-    (#set! injection.language "js"))
+    (#set! injection.language "js")
+    (#set! injection.combined))
+
+; Bodies of registered raw-text tags from the JSTL sql and xml libraries. Each
+; body is a statement or document of its own, so these are not combined.
+(raw_text_element
+  (start_tag
+    (tag_name
+      prefix: (namespace) @_ns))
+  (raw_text) @injection.content
+  (#eq? @_ns "sql")
+  (#set! injection.language "sql"))
+
+(raw_text_element
+  (start_tag
+    (tag_name
+      prefix: (namespace) @_ns))
+  (raw_text) @injection.content
+  (#eq? @_ns "x")
+  (#set! injection.language "xml"))
@@ -1,3 +1,4 @@
+#include "chars.h"
 #include "tag.h"
 #include "tree_sitter/alloc.h"
 #include "tree_sitter/array.h"
@@ -6,17 +7,19 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
-#include <wctype.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 enum TokenType {
-  JSP_SCRIPTLET,
-  JSP_EXPRESSION,
-  JSP_DECLARATION,
+  JSP_SCRIPTLET_START,
+  JSP_EXPRESSION_START,
+  JSP_DECLARATION_START,
   JSP_COMMENT,
   JSP_DIRECTIVE_START,
-  EL_EXPRESSION,
+  EL_EXPRESSION_START,
   TEXT_FRAGMENT,
-  INTERPOLATION_TEXT,
   START_TAG_NAME,
   TEMPLATE_START_TAG_NAME,
   SCRIPT_START_TAG_NAME,
@@ -26,43 +29,239 @@ enum TokenType {
   SELF_CLOSING_TAG_DELIMITER,
   IMPLICIT_END_TAG,
   RAW_TEXT,
-  COMMENT
+  COMMENT,
+  JAVA_CONTENT,
+  RAW_TEXT_START_TAG_NAME,
+  COMMENT_CHUNK,
+  COMMENT_TAIL,
+  JSP_COMMENT_CHUNK,
+  JSP_COMMENT_TAIL,
+  DOCTYPE,
+  CDATA_SECTION,
+  PROCESSING_INSTRUCTION,
+  WHITESPACE,
+  TAGLIB_START_TAG_NAME,
+  TAG_LOCAL_NAME,
+  DOUBLE_QUOTED_ATTRIBUTE_TEXT,
+  SINGLE_QUOTED_ATTRIBUTE_TEXT,
+  TOKEN_TYPE_COUNT
+};
+
+#define TOKEN_BIT(token) (1u << (token))
+
+_Static_assert(TOKEN_TYPE_COUNT <= 32,
+               "valid symbols must fit in the uint32_t mask of a ScanMode");
+
+// Benchmarks define JSP_SCANNER_STATS before including this file to count
+// scanner calls and how they end.
+#ifdef JSP_SCANNER_STATS
+static unsigned long scanner_stat_calls;
+static unsigned long scanner_stat_fast_rejections;
+#define SCANNER_STAT(counter) (scanner_stat_##counter++)
+#else
+#define SCANNER_STAT(counter) ((void)0)
+#endif
+
+// Classes of the character a token can start with. Each valid-symbol row the
+// parser passes in is mapped to a ScanMode holding the set of classes that
+// can start one of its tokens, so positions where nothing can match are
+// rejected before any of the scan_* routines run.
+enum {
+  FIRST_SPACE = 1 << 0,
+  FIRST_LT = 1 << 1,
+  FIRST_EL = 1 << 2,
+  FIRST_SLASH = 1 << 3,
+  FIRST_EOF = 1 << 4,
+  FIRST_TAG_NAME = 1 << 5,
+  FIRST_OTHER = 1 << 6,
 };
 
+enum {
+  MODE_ERROR_RECOVERY = 1 << 0,
+  MODE_TEXT = 1 << 1,
+  MODE_TAG_NAME = 1 << 2,
+  MODE_JAVA_CONTENT = 1 << 3,
+  MODE_COMMENT_BODY = 1 << 4,
+  MODE_JSP_COMMENT_BODY = 1 << 5,
+  // Whitespace at the start is a WHITESPACE token rather than content.
+  MODE_WHITESPACE = 1 << 6,
+  MODE_ATTRIBUTE_TEXT = 1 << 7,
+};
+
+typedef struct {
+  uint32_t valid_symbols;
+  uint8_t first_chars;
+  uint8_t flags;
+} ScanMode;
+
+#define SCAN_MODE_CACHE_SIZE 32
+
 // Tag struct is now defined in tag_a.h
 
 typedef struct {
   Array(Tag) tags;
+  TagNames names;
+  // How many tags of each type are on the stack, and how many custom tags
+  // with each interned name, so that whether a tag is open anywhere can be
+  // answered without searching the stack.
+  uint32_t open_tag_counts[END_ + 1];
+  Array(uint32_t) open_custom_tag_counts;
+  // Scratch space for serialization: the index + 1 each name ID gets in the
+  // serialized state.
+  Array(uint32_t) name_indices;
+  // The last state written or read, valid until the tag stack changes, the
+  // bounds of its name section, and the interned IDs of those names.
+  Array(char) state;
+  uint32_t state_names_start;
+  uint32_t state_names_end;
+  Array(uint32_t) serialized_names;
+  // This scanner's copy of the registered custom tag names and the kind of
+  // each. They are interned first in `names`, so their IDs there are 1 to
+  // custom_tag_kinds.size, and are interned again whenever it is cleared.
+  TagNames registered_names;
+  Array(uint8_t) custom_tag_kinds;
+  // The upper-cased prefixes declared by taglib directives so far, each
+  // preceded by its length in a byte.
+  Array(char) taglib_prefixes;
+  // Whether template text that is only whitespace is a WHITESPACE token
+  // instead of a text node.
+  bool skip_whitespace_text;
+  bool state_dirty;
+  ScanMode modes[SCAN_MODE_CACHE_SIZE];
 } Scanner;
 
-// Tag helper functions are now provided by tag_a.h
+// How the scanner treats a custom tag registered through the public API.
+enum {
+  CUSTOM_TAG_PLAIN,
+  // Never has content or an end tag, like the HTML void elements.
+  CUSTOM_TAG_VOID,
+  // Holds a single raw_text up to its end tag, like script and style.
+  CUSTOM_TAG_RAW_TEXT,
+};
+
+// Upper-cased custom tag names registered for the whole process, and the kind
+// of each. Scanners copy them when they are created.
+static TagNames registered_tag_names;
+static Array(uint8_t) registered_tag_kinds;
+static bool default_skip_whitespace_text;
+
+// The settings above are written through the public API and copied whenever
+// a parser creates a scanner, possibly on other threads, so both sides hold
+// this lock. It is only held to copy a few small tables.
+#ifdef _MSC_VER
+static volatile long settings_lock;
+
+static inline void settings_lock_acquire(void) {
+  while (_InterlockedCompareExchange(&settings_lock, 1, 0) != 0) {
+  }
+}
 
-static TagType get_tag_type_for_name(const char *name) {
-  String tag_name = {0};
-  size_t len = strlen(name);
+static inline void settings_lock_release(void) {
+  _InterlockedExchange(&settings_lock, 0);
+}
+#else
+static bool settings_lock;
 
-  // Convert to uppercase and create String
-  array_reserve(&tag_name, len);
-  for (size_t i = 0; i < len; i++) {
-    array_push(&tag_name, towupper(name[i]));
+static inline void settings_lock_acquire(void) {
+  while (__atomic_test_and_set(&settings_lock, __ATOMIC_ACQUIRE)) {
   }
+}
 
-  TagType result = tag_type_for_name(&tag_name);
-  array_delete(&tag_name);
-  return result;
+static inline void settings_lock_release(void) {
+  __atomic_clear(&settings_lock, __ATOMIC_RELEASE);
 }
+#endif
 
-static Tag create_tag_from_name(const char *name) {
-  String tag_name = {0};
-  size_t len = strlen(name);
+static bool register_custom_tag(const char *name, uint8_t kind) {
+  char buffer[256];
+  size_t length = strlen(name);
+  if (length == 0 || length >= sizeof(buffer))
+    return false;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)name[i];
+    if (c >= 0x80 || !char_is_tag_name(c))
+      return false;
+    buffer[i] = (char)char_to_upper(c);
+  }
+  if (tag_type_for_name(buffer, length) != CUSTOM)
+    return false;
 
-  // Convert to uppercase and create String
-  array_reserve(&tag_name, len);
-  for (size_t i = 0; i < len; i++) {
-    array_push(&tag_name, towupper(name[i]));
+  settings_lock_acquire();
+  if (registered_tag_names.offsets.size == 0) {
+    tag_names_init(&registered_tag_names);
   }
+  uint32_t id = tag_names_intern(&registered_tag_names, buffer, length);
+  if (id > registered_tag_kinds.size) {
+    array_push(&registered_tag_kinds, kind);
+  } else {
+    registered_tag_kinds.contents[id - 1] = kind;
+  }
+  settings_lock_release();
+  return true;
+}
+
+bool tree_sitter_jsp_register_void_tag(const char *name) {
+  return register_custom_tag(name, CUSTOM_TAG_VOID);
+}
 
-  return tag_for_name(tag_name); // Uses tag.h implementation
+bool tree_sitter_jsp_register_raw_text_tag(const char *name) {
+  return register_custom_tag(name, CUSTOM_TAG_RAW_TEXT);
+}
+
+void tree_sitter_jsp_clear_registered_tags(void) {
+  settings_lock_acquire();
+  tag_names_delete(&registered_tag_names);
+  array_delete(&registered_tag_kinds);
+  memset(&registered_tag_names, 0, sizeof(registered_tag_names));
+  settings_lock_release();
+}
+
+void tree_sitter_jsp_set_whitespace_text(bool keep) {
+  settings_lock_acquire();
+  default_skip_whitespace_text = !keep;
+  settings_lock_release();
+}
+
+// Interns the scanner's registered names into an empty names table, where
+// they get the same IDs as in the registry.
+static void scanner_intern_registered_tags(Scanner *scanner) {
+  for (uint32_t id = 1; id <= scanner->custom_tag_kinds.size; id++) {
+    unsigned length;
+    const char *name = tag_names_get(&scanner->registered_names, id, &length);
+    tag_names_intern(&scanner->names, name, length);
+  }
+}
+
+// Copies the process-wide registry, so that clearing it later does not
+// affect this scanner. The settings lock must be held.
+static void scanner_copy_registered_tags(Scanner *scanner) {
+  for (uint32_t id = 1; id <= registered_tag_kinds.size; id++) {
+    unsigned length;
+    const char *name = tag_names_get(&registered_tag_names, id, &length);
+    tag_names_intern(&scanner->registered_names, name, length);
+  }
+  array_extend(&scanner->custom_tag_kinds, registered_tag_kinds.size,
+               registered_tag_kinds.contents);
+  scanner_intern_registered_tags(scanner);
+}
+
+static inline uint8_t scanner_custom_tag_kind(const Scanner *scanner,
+                                              const Tag *tag) {
+  if (tag->type != CUSTOM || tag->name_id > scanner->custom_tag_kinds.size)
+    return CUSTOM_TAG_PLAIN;
+  return scanner->custom_tag_kinds.contents[tag->name_id - 1];
+}
+
+static inline bool scanner_tag_is_void(const Scanner *scanner,
+                                       const Tag *tag) {
+  return tag_is_void(tag) ||
+         scanner_custom_tag_kind(scanner, tag) == CUSTOM_TAG_VOID;
+}
+
+static inline bool scanner_tag_has_raw_text(const Scanner *scanner,
+                                            const Tag *tag) {
+  return tag->type == SCRIPT || tag->type == STYLE ||
+         scanner_custom_tag_kind(scanner, tag) == CUSTOM_TAG_RAW_TEXT;
 }
 
 // tag_can_contain is now provided by tag_a.h
@@ -71,208 +270,960 @@ static Tag create_tag_from_name(const char *name) {
 static Scanner *scanner_new(void) {
   Scanner *scanner = ts_malloc(sizeof(Scanner));
   array_init(&scanner->tags);
+  tag_names_init(&scanner->names);
+  memset(scanner->open_tag_counts, 0, sizeof(scanner->open_tag_counts));
+  array_init(&scanner->open_custom_tag_counts);
+  array_init(&scanner->name_indices);
+  array_init(&scanner->serialized_names);
+  array_init(&scanner->state);
+  tag_names_init(&scanner->registered_names);
+  array_init(&scanner->custom_tag_kinds);
+  array_init(&scanner->taglib_prefixes);
+  settings_lock_acquire();
+  if (registered_tag_kinds.size > 0) {
+    scanner_copy_registered_tags(scanner);
+  }
+  scanner->skip_whitespace_text = default_skip_whitespace_text;
+  settings_lock_release();
+  scanner->state_names_start = 0;
+  scanner->state_names_end = 0;
+  scanner->state_dirty = false;
+  for (unsigned i = 0; i < SCAN_MODE_CACHE_SIZE; i++) {
+    scanner->modes[i].valid_symbols = UINT32_MAX;
+  }
   return scanner;
 }
 
 static void scanner_delete(Scanner *scanner) {
-  for (uint32_t i = 0; i < scanner->tags.size; i++) {
-    tag_free(&scanner->tags.contents[i]);
-  }
   array_delete(&scanner->tags);
+  tag_names_delete(&scanner->names);
+  array_delete(&scanner->open_custom_tag_counts);
+  array_delete(&scanner->name_indices);
+  array_delete(&scanner->serialized_names);
+  array_delete(&scanner->state);
+  tag_names_delete(&scanner->registered_names);
+  array_delete(&scanner->custom_tag_kinds);
+  array_delete(&scanner->taglib_prefixes);
   ts_free(scanner);
 }
 
-static unsigned scanner_serialize(Scanner *scanner, char *buffer) {
-  uint16_t tag_count =
-      scanner->tags.size > UINT16_MAX ? UINT16_MAX : scanner->tags.size;
-  uint16_t serialized_tag_count = 0;
+static inline uint32_t *scanner_open_count(Scanner *scanner, const Tag *tag) {
+  if (tag->type != CUSTOM)
+    return &scanner->open_tag_counts[tag->type];
+  uint32_t size = scanner->open_custom_tag_counts.size;
+  if (tag->name_id >= size) {
+    array_grow_by(&scanner->open_custom_tag_counts, tag->name_id + 1 - size);
+  }
+  return &scanner->open_custom_tag_counts.contents[tag->name_id];
+}
 
-  unsigned i = sizeof(tag_count);
-  memcpy(&buffer[i], &tag_count, sizeof(tag_count));
-  i += sizeof(tag_count);
+static inline bool scanner_tag_is_open(const Scanner *scanner,
+                                       const Tag *tag) {
+  if (tag->type != CUSTOM)
+    return scanner->open_tag_counts[tag->type] > 0;
+  return tag->name_id < scanner->open_custom_tag_counts.size &&
+         scanner->open_custom_tag_counts.contents[tag->name_id] > 0;
+}
 
-  for (; serialized_tag_count < tag_count; serialized_tag_count++) {
-    Tag *tag = &scanner->tags.contents[serialized_tag_count];
+// All changes to the tag stack go through these, which keep the open counts
+// in step and mark the cached state as out of date.
+static inline void scanner_push_tag(Scanner *scanner, Tag tag) {
+  array_push(&scanner->tags, tag);
+  (*scanner_open_count(scanner, &tag))++;
+  scanner->state_dirty = true;
+}
+
+static inline void scanner_pop_tag(Scanner *scanner) {
+  (*scanner_open_count(scanner, array_back(&scanner->tags)))--;
+  (void)array_pop(&scanner->tags);
+  scanner->state_dirty = true;
+}
+
+static void scanner_clear_tags(Scanner *scanner) {
+  while (scanner->tags.size > 0) {
+    scanner_pop_tag(scanner);
+  }
+}
+
+// Taglib prefixes are kept in the serialized state, so their total size is
+// bounded. Prefixes declared past the limit are ignored, and their elements
+// stay plain elements.
+#define TAGLIB_PREFIX_MAX_LENGTH 32
+#define TAGLIB_PREFIXES_MAX_SIZE 256
+
+static bool scanner_has_taglib_prefix(const Scanner *scanner,
+                                      const char *prefix, unsigned length) {
+  const char *prefixes = scanner->taglib_prefixes.contents;
+  for (uint32_t i = 0; i < scanner->taglib_prefixes.size;
+       i += 1 + (uint8_t)prefixes[i]) {
+    if ((uint8_t)prefixes[i] == length &&
+        memcmp(&prefixes[i + 1], prefix, length) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void scanner_add_taglib_prefix(Scanner *scanner, const char *prefix,
+                                      unsigned length) {
+  if (length == 0 || length > TAGLIB_PREFIX_MAX_LENGTH ||
+      scanner->taglib_prefixes.size + 1 + length > TAGLIB_PREFIXES_MAX_SIZE ||
+      scanner_has_taglib_prefix(scanner, prefix, length))
+    return;
+  array_push(&scanner->taglib_prefixes, (char)length);
+  array_extend(&scanner->taglib_prefixes, length, prefix);
+  scanner->state_dirty = true;
+}
+
+// Whether an upper-cased custom tag name has a declared taglib prefix.
+static bool scanner_is_taglib_name(const Scanner *scanner, const char *name,
+                                   unsigned length) {
+  const char *colon = memchr(name, ':', length);
+  return colon &&
+         scanner_has_taglib_prefix(scanner, name, (unsigned)(colon - name));
+}
+
+// Serialized state layout. Every integer is an unsigned LEB128 varint.
+//
+//   version byte
+//   tag count, then the number of bottom-most tags that were left out
+//   name count, then each custom name as its length and bytes
+//   one code byte per stored tag, bottom to top
+//   size of the taglib prefixes, then the prefixes as the scanner keeps them
+//
+// A code byte below SERIALIZED_CUSTOM_TAG is the TagType of a built-in tag.
+// Otherwise the tag is custom and the byte holds the index of its name, or
+// SERIALIZED_CUSTOM_TAG_ESCAPE followed by a varint for larger indices.
+//
+// An empty stack with no taglib prefixes serializes to nothing. When the whole
+// stack does not fit, the bottom-most tags are left out and deserialize as
+// placeholders that match no end tag, so the stack depth and the tags nearest
+// to the cursor always survive.
+#define SERIALIZATION_VERSION 2
+#define SERIALIZATION_HEADER_MAX_SIZE (1 + 3 * 5)
+#define SERIALIZED_CUSTOM_TAG 0x80
+#define SERIALIZED_CUSTOM_TAG_ESCAPE 0xFF
+#define SERIALIZED_CUSTOM_TAG_INLINE_INDICES                                   \
+  (SERIALIZED_CUSTOM_TAG_ESCAPE - SERIALIZED_CUSTOM_TAG)
+
+static unsigned varint_size(uint32_t value) {
+  unsigned size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+static unsigned write_varint(char *buffer, unsigned i, uint32_t value) {
+  while (value >= 0x80) {
+    buffer[i++] = (char)((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  buffer[i++] = (char)value;
+  return i;
+}
+
+// Reads a varint at `*i`, returning false if it is malformed or runs past
+// `length`.
+static bool read_varint(const char *buffer, unsigned length, unsigned *i,
+                        uint32_t *value) {
+  uint32_t result = 0;
+  for (unsigned shift = 0; shift < 35 && *i < length; shift += 7) {
+    uint8_t byte = (uint8_t)buffer[(*i)++];
+    result |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static unsigned custom_tag_code_size(uint32_t index) {
+  return index < SERIALIZED_CUSTOM_TAG_INLINE_INDICES
+             ? 1
+             : 1 + varint_size(index - SERIALIZED_CUSTOM_TAG_INLINE_INDICES);
+}
+
+static unsigned encode_tag_stack(Scanner *scanner, char *buffer) {
+  if (scanner->tags.size == 0 && scanner->taglib_prefixes.size == 0) {
+    array_clear(&scanner->serialized_names);
+    scanner->state_names_start = scanner->state_names_end = 0;
+    return 0;
+  }
+
+  uint32_t name_count = tag_names_count(&scanner->names);
+  if (scanner->name_indices.size <= name_count) {
+    array_grow_by(&scanner->name_indices,
+                  name_count + 1 - scanner->name_indices.size);
+  }
+  array_clear(&scanner->serialized_names);
+
+  // Walk down from the top of the stack, keeping as many tags as fit and
+  // numbering custom names in order of first appearance.
+  const unsigned budget = TREE_SITTER_SERIALIZATION_BUFFER_SIZE -
+                          SERIALIZATION_HEADER_MAX_SIZE -
+                          varint_size(scanner->taglib_prefixes.size) -
+                          scanner->taglib_prefixes.size;
+  unsigned size = 0;
+  uint32_t kept_from = scanner->tags.size;
+  while (kept_from > 0) {
+    const Tag *tag = &scanner->tags.contents[kept_from - 1];
+    // Placeholders for tags left out of an earlier state stay left out.
+    if (tag->type == END_)
+      break;
+    unsigned cost = 1;
+    uint32_t new_name_index = 0;
     if (tag->type == CUSTOM) {
-      unsigned name_length = tag->custom_tag_name.size;
-      if (name_length > UINT8_MAX)
-        name_length = UINT8_MAX;
-      if (i + 2 + name_length >= TREE_SITTER_SERIALIZATION_BUFFER_SIZE)
-        break;
-      buffer[i++] = (char)tag->type;
-      buffer[i++] = name_length;
-      if (name_length > 0) {
-        memcpy(&buffer[i], tag->custom_tag_name.contents, name_length);
-        i += name_length;
+      uint32_t index = scanner->name_indices.contents[tag->name_id];
+      if (index == 0) {
+        unsigned name_length;
+        tag_names_get(&scanner->names, tag->name_id, &name_length);
+        new_name_index = index = scanner->serialized_names.size + 1;
+        cost = varint_size(name_length) + name_length;
+      } else {
+        cost = 0;
       }
-    } else {
-      if (i + 1 >= TREE_SITTER_SERIALIZATION_BUFFER_SIZE)
-        break;
+      cost += custom_tag_code_size(index - 1);
+    }
+    if (size + cost > budget)
+      break;
+    if (new_name_index) {
+      scanner->name_indices.contents[tag->name_id] = new_name_index;
+      array_push(&scanner->serialized_names, tag->name_id);
+    }
+    size += cost;
+    kept_from--;
+  }
+
+  unsigned i = 0;
+  buffer[i++] = SERIALIZATION_VERSION;
+  i = write_varint(buffer, i, scanner->tags.size);
+  i = write_varint(buffer, i, kept_from);
+  i = write_varint(buffer, i, scanner->serialized_names.size);
+  scanner->state_names_start = i;
+  for (uint32_t j = 0; j < scanner->serialized_names.size; j++) {
+    unsigned name_length;
+    const char *name = tag_names_get(
+        &scanner->names, scanner->serialized_names.contents[j], &name_length);
+    i = write_varint(buffer, i, name_length);
+    memcpy(&buffer[i], name, name_length);
+    i += name_length;
+  }
+  scanner->state_names_end = i;
+  for (uint32_t j = kept_from; j < scanner->tags.size; j++) {
+    const Tag *tag = &scanner->tags.contents[j];
+    if (tag->type != CUSTOM) {
       buffer[i++] = (char)tag->type;
+      continue;
+    }
+    uint32_t index = scanner->name_indices.contents[tag->name_id] - 1;
+    if (index < SERIALIZED_CUSTOM_TAG_INLINE_INDICES) {
+      buffer[i++] = (char)(SERIALIZED_CUSTOM_TAG + index);
+    } else {
+      buffer[i++] = (char)SERIALIZED_CUSTOM_TAG_ESCAPE;
+      i = write_varint(buffer, i, index - SERIALIZED_CUSTOM_TAG_INLINE_INDICES);
     }
   }
+  i = write_varint(buffer, i, scanner->taglib_prefixes.size);
+  if (scanner->taglib_prefixes.size > 0) {
+    memcpy(&buffer[i], scanner->taglib_prefixes.contents,
+           scanner->taglib_prefixes.size);
+    i += scanner->taglib_prefixes.size;
+  }
 
-  memcpy(&buffer[0], &serialized_tag_count, sizeof(serialized_tag_count));
+  for (uint32_t j = 0; j < scanner->serialized_names.size; j++) {
+    scanner->name_indices.contents[scanner->serialized_names.contents[j]] = 0;
+  }
   return i;
 }
 
-static void scanner_deserialize(Scanner *scanner, const char *buffer,
-                                unsigned length) {
-  for (uint32_t i = 0; i < scanner->tags.size; i++) {
-    tag_free(&scanner->tags.contents[i]);
-  }
-  array_clear(&scanner->tags);
-
-  if (length > 0) {
-    unsigned i = 0;
-    uint16_t tag_count, serialized_tag_count;
-
-    memcpy(&serialized_tag_count, &buffer[i], sizeof(serialized_tag_count));
-    i += sizeof(serialized_tag_count);
-
-    memcpy(&tag_count, &buffer[i], sizeof(tag_count));
-    i += sizeof(tag_count);
-
-    array_reserve(&scanner->tags, tag_count);
-    array_grow_by(&scanner->tags, tag_count);
-
-    for (unsigned j = 0; j < serialized_tag_count; j++) {
-      Tag *tag = &scanner->tags.contents[j];
-      *tag = tag_new();
-      tag->type = (TagType)buffer[i++];
-      if (tag->type == CUSTOM) {
-        uint16_t name_length = (uint8_t)buffer[i++];
-        if (name_length > 0) {
-          array_reserve(&tag->custom_tag_name, name_length);
-          for (uint16_t k = 0; k < name_length; k++) {
-            array_push(&tag->custom_tag_name, buffer[i++]);
-          }
-        }
+// Rebuilds the tag stack from a state, returning false if it is malformed.
+static bool decode_tag_stack(Scanner *scanner, const char *buffer,
+                             unsigned length) {
+  scanner_clear_tags(scanner);
+  array_clear(&scanner->taglib_prefixes);
+  if (tag_names_count(&scanner->names) > TAG_NAMES_MAX_RETAINED) {
+    tag_names_clear(&scanner->names);
+    scanner_intern_registered_tags(scanner);
+    array_clear(&scanner->serialized_names);
+    scanner->state_names_start = scanner->state_names_end = 0;
+  }
+
+  if (length == 0)
+    return true;
+  if ((uint8_t)buffer[0] != SERIALIZATION_VERSION)
+    return false;
+
+  unsigned i = 1;
+  uint32_t tag_count, elided_count, name_count;
+  if (!read_varint(buffer, length, &i, &tag_count) ||
+      !read_varint(buffer, length, &i, &elided_count) ||
+      !read_varint(buffer, length, &i, &name_count) ||
+      elided_count > tag_count)
+    return false;
+
+  // Map the serialized name indices to interned IDs. Consecutive states
+  // usually list the same names, in which case the IDs found for the cached
+  // state still apply.
+  uint32_t names_start = i;
+  uint32_t cached_names_size =
+      scanner->state_names_end - scanner->state_names_start;
+  if (name_count == scanner->serialized_names.size &&
+      cached_names_size <= length - i &&
+      (cached_names_size == 0 ||
+       memcmp(&buffer[i], &scanner->state.contents[scanner->state_names_start],
+              cached_names_size) == 0)) {
+    i += cached_names_size;
+  } else {
+    array_clear(&scanner->serialized_names);
+    for (uint32_t j = 0; j < name_count; j++) {
+      uint32_t name_length;
+      if (!read_varint(buffer, length, &i, &name_length) ||
+          name_length > length - i)
+        return false;
+      array_push(&scanner->serialized_names,
+                 tag_names_intern(&scanner->names, &buffer[i], name_length));
+      i += name_length;
+    }
+  }
+  scanner->state_names_start = names_start;
+  scanner->state_names_end = i;
+
+  if (tag_count - elided_count > length - i)
+    return false;
+  array_reserve(&scanner->tags, tag_count);
+  for (uint32_t j = 0; j < elided_count; j++) {
+    scanner_push_tag(scanner, tag_new());
+  }
+  while (scanner->tags.size < tag_count && i < length) {
+    uint8_t code = (uint8_t)buffer[i++];
+    Tag tag = tag_new();
+    if (code < SERIALIZED_CUSTOM_TAG) {
+      if (code >= CUSTOM)
+        break;
+      tag.type = (TagType)code;
+    } else {
+      uint32_t index = code - SERIALIZED_CUSTOM_TAG;
+      if (code == SERIALIZED_CUSTOM_TAG_ESCAPE) {
+        if (!read_varint(buffer, length, &i, &index))
+          break;
+        index += SERIALIZED_CUSTOM_TAG_INLINE_INDICES;
       }
+      if (index >= name_count)
+        break;
+      tag.type = CUSTOM;
+      tag.name_id = scanner->serialized_names.contents[index];
     }
+    scanner_push_tag(scanner, tag);
+  }
+  if (scanner->tags.size != tag_count)
+    return false;
+
+  uint32_t prefixes_size;
+  if (!read_varint(buffer, length, &i, &prefixes_size) ||
+      prefixes_size != length - i)
+    return false;
+  for (uint32_t j = i; j < length; j += 1 + (uint8_t)buffer[j]) {
+    if ((uint8_t)buffer[j] > length - j - 1)
+      return false;
+  }
+  array_extend(&scanner->taglib_prefixes, prefixes_size, &buffer[i]);
+  return true;
+}
+
+static unsigned scanner_serialize(Scanner *scanner, char *buffer) {
+  if (scanner->state_dirty) {
+    unsigned length = encode_tag_stack(scanner, buffer);
+    array_clear(&scanner->state);
+    array_extend(&scanner->state, length, buffer);
+    scanner->state_dirty = false;
+    return length;
+  }
+  if (scanner->state.size > 0)
+    memcpy(buffer, scanner->state.contents, scanner->state.size);
+  return scanner->state.size;
+}
+
+static void scanner_deserialize(Scanner *scanner, const char *buffer,
+                                unsigned length) {
+  // Tree-sitter restores the same state before many consecutive scans.
+  if (!scanner->state_dirty && length == scanner->state.size &&
+      (length == 0 || memcmp(buffer, scanner->state.contents, length) == 0))
+    return;
+
+  bool valid = decode_tag_stack(scanner, buffer, length);
+  array_clear(&scanner->state);
+  if (valid) {
+    array_extend(&scanner->state, length, buffer);
+    scanner->state_dirty = false;
+  } else {
+    scanner_clear_tags(scanner);
+    array_clear(&scanner->taglib_prefixes);
+    array_clear(&scanner->serialized_names);
+    scanner->state_names_start = scanner->state_names_end = 0;
+    scanner->state_dirty = true;
+  }
+}
+
+// Scan mode helpers
+static inline bool mode_allows(const ScanMode *mode, enum TokenType token) {
+  return (mode->valid_symbols & TOKEN_BIT(token)) != 0;
+}
+
+static ScanMode scan_mode_new(uint32_t valid_symbols,
+                              bool skip_whitespace_text) {
+  ScanMode mode = {.valid_symbols = valid_symbols};
+  if (mode_allows(&mode, WHITESPACE))
+    mode.flags |= MODE_WHITESPACE;
+
+  if (mode_allows(&mode, START_TAG_NAME) && mode_allows(&mode, RAW_TEXT)) {
+    mode.flags |= MODE_ERROR_RECOVERY;
+  } else if (mode_allows(&mode, JAVA_CONTENT)) {
+    // The body of a scriptlet, expression or declaration, which can start
+    // with any character.
+    mode.flags |= MODE_JAVA_CONTENT;
+    mode.first_chars = UINT8_MAX;
+    return mode;
+  } else if (mode_allows(&mode, COMMENT_TAIL) ||
+             mode_allows(&mode, JSP_COMMENT_TAIL)) {
+    // The rest of a comment split into chunks. The tail tokens are only
+    // valid after a chunk, so this is never the start of a new comment.
+    mode.flags &= ~MODE_WHITESPACE;
+    mode.flags |= mode_allows(&mode, COMMENT_TAIL) ? MODE_COMMENT_BODY
+                                                   : MODE_JSP_COMMENT_BODY;
+    mode.first_chars = UINT8_MAX;
+    return mode;
+  } else if (mode_allows(&mode, DOUBLE_QUOTED_ATTRIBUTE_TEXT) ||
+             mode_allows(&mode, SINGLE_QUOTED_ATTRIBUTE_TEXT)) {
+    // Inside a quoted attribute value, where whitespace is part of the value
+    // and any character can start its text.
+    mode.flags &= ~MODE_WHITESPACE;
+    mode.flags |= MODE_ATTRIBUTE_TEXT;
+    mode.first_chars = UINT8_MAX;
+    return mode;
+  } else if (mode_allows(&mode, TEXT_FRAGMENT)) {
+    // Text starts with the whitespace before it, unless whitespace-only text
+    // is turned off.
+    if (!skip_whitespace_text)
+      mode.flags &= ~MODE_WHITESPACE;
+    mode.flags |= MODE_TEXT;
+    mode.first_chars |= FIRST_SPACE | FIRST_EL | FIRST_SLASH |
+                        FIRST_TAG_NAME | FIRST_OTHER;
+  }
+
+  // Comments and JSP constructs are recognized after '<' in every mode.
+  mode.first_chars |= FIRST_LT;
+  if (mode_allows(&mode, WHITESPACE))
+    mode.first_chars |= FIRST_SPACE;
+  if (mode_allows(&mode, EL_EXPRESSION_START))
+    mode.first_chars |= FIRST_EL;
+  if (mode_allows(&mode, IMPLICIT_END_TAG))
+    mode.first_chars |= FIRST_EOF;
+  if (mode_allows(&mode, SELF_CLOSING_TAG_DELIMITER))
+    mode.first_chars |= FIRST_SLASH;
+  if ((mode_allows(&mode, START_TAG_NAME) ||
+       mode_allows(&mode, END_TAG_NAME)) &&
+      !mode_allows(&mode, RAW_TEXT)) {
+    mode.flags |= MODE_TAG_NAME;
+    mode.first_chars |= FIRST_TAG_NAME;
+  }
+  return mode;
+}
+
+// Tree-sitter passes one of a handful of fixed valid-symbol rows, so modes are
+// built once per row and looked up by its bitmask afterwards.
+static const ScanMode *scanner_mode(Scanner *scanner,
+                                    const bool *valid_symbols) {
+  uint32_t mask = 0;
+  for (unsigned i = 0; i < TOKEN_TYPE_COUNT; i++) {
+    mask |= (uint32_t)valid_symbols[i] << i;
+  }
+
+  ScanMode *mode =
+      &scanner->modes[(mask * 0x9E3779B1u) >> 27 & (SCAN_MODE_CACHE_SIZE - 1)];
+  if (mode->valid_symbols != mask) {
+    *mode = scan_mode_new(mask, scanner->skip_whitespace_text);
+  }
+  return mode;
+}
+
+static inline uint8_t first_char_class(int32_t c) {
+  switch (c) {
+  case '\0':
+    return FIRST_EOF;
+  case '<':
+    return FIRST_LT;
+  case '$':
+  case '#':
+    return FIRST_EL;
+  case '/':
+    return FIRST_SLASH;
+  default:
+    if (char_is_space(c))
+      return FIRST_SPACE;
+    return char_is_tag_name(c) ? FIRST_TAG_NAME : FIRST_OTHER;
   }
 }
 
+// Returns false if no token of the mode can start at the lookahead.
+static inline bool scan_mode_can_start(const ScanMode *mode,
+                                       const TSLexer *lexer) {
+  return (mode->first_chars & first_char_class(lexer->lookahead)) != 0;
+}
+
+static inline bool inside_raw_text_element(const Scanner *scanner) {
+  if (scanner->tags.size == 0)
+    return false;
+  return scanner_tag_has_raw_text(scanner, array_back(&scanner->tags));
+}
+
 // Scanning helper functions
-static void scan_tag_name(TSLexer *lexer, char *buffer, size_t buffer_size) {
+// Writes the UTF-8 encoding of `c` to `buffer` and returns its length, or 0 if
+// it does not fit in `available` bytes.
+static size_t encode_utf8(int32_t c, char *buffer, size_t available) {
+  if (c < 0x80) {
+    if (available < 1)
+      return 0;
+    buffer[0] = (char)c;
+    return 1;
+  }
+  if (c < 0x800) {
+    if (available < 2)
+      return 0;
+    buffer[0] = (char)(0xC0 | (c >> 6));
+    buffer[1] = (char)(0x80 | (c & 0x3F));
+    return 2;
+  }
+  if (c < 0x10000) {
+    if (available < 3)
+      return 0;
+    buffer[0] = (char)(0xE0 | (c >> 12));
+    buffer[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+    buffer[2] = (char)(0x80 | (c & 0x3F));
+    return 3;
+  }
+  if (available < 4)
+    return 0;
+  buffer[0] = (char)(0xF0 | (c >> 18));
+  buffer[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+  buffer[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+  buffer[3] = (char)(0x80 | (c & 0x3F));
+  return 4;
+}
+
+// Scans an upper-cased tag name into `buffer` and returns its length. If
+// `prefix_length` is given, the token of a namespaced name such as c:forEach
+// ends before the colon and the length of the prefix is stored there; it is 0
+// for a name without one. The rest of the name is the TAG_LOCAL_NAME token.
+static unsigned scan_tag_name(TSLexer *lexer, char *buffer, size_t buffer_size,
+                              unsigned *prefix_length) {
   size_t i = 0;
-  while (i < buffer_size - 1 &&
-         (iswalnum(lexer->lookahead) || lexer->lookahead == '-' ||
-          lexer->lookahead == ':')) {
-    buffer[i++] = towupper(lexer->lookahead);
+  if (prefix_length)
+    *prefix_length = 0;
+  while (char_is_tag_name(lexer->lookahead)) {
+    if (prefix_length && *prefix_length == 0 && i > 0 &&
+        lexer->lookahead == ':') {
+      lexer->mark_end(lexer);
+      *prefix_length = i;
+    }
+    size_t written = encode_utf8(char_to_upper(lexer->lookahead), &buffer[i],
+                                 buffer_size - 1 - i);
+    if (written == 0)
+      break;
+    i += written;
     lexer->advance(lexer, false);
   }
   buffer[i] = '\0';
+
+  // A name ending in its first colon has no local part and stays one token.
+  if (prefix_length && *prefix_length > 0 && *prefix_length + 1 == i) {
+    lexer->mark_end(lexer);
+    *prefix_length = 0;
+  }
+  return i;
 }
 
-static bool scan_jsp_directive_start(TSLexer *lexer) {
-  // We've already seen <%@, just return the start token
-  // The grammar will handle parsing the rest
-  lexer->result_symbol = JSP_DIRECTIVE_START;
+// Raw text, Java code and comments can run to megabytes, so they are split
+// into chunk tokens and an edit only relexes the chunk around it. Boundaries
+// are content-defined, as in FastCDC: each character shifts its entry of
+// CHUNK_GEAR into a 64-bit hash, and a chunk ends where the top
+// CHUNK_HASH_BITS bits of the hash are clear, about every 4K characters.
+// Only the last 64 characters affect the hash, so the boundaries do not
+// depend on where the chunk started: once an incremental reparse is past the
+// edit, its chunks end where the old ones did and the rest are reused.
+// CHUNK_MAX_SIZE caps the rare long run without a boundary.
+#define CHUNK_MIN_SIZE 64
+#define CHUNK_HASH_BITS 12
+#define CHUNK_MAX_SIZE (1u << 16)
+
+// splitmix64 of 0 to 255.
+static const uint64_t CHUNK_GEAR[256] = {
+    0xe220a8397b1dcdafull, 0x6e789e6aa1b965f4ull, 0x06c45d188009454full,
+    0xf88bb8a8724c81ecull, 0x1b39896a51a8749bull, 0x53cb9f0c747ea2eaull,
+    0x2c829abe1f4532e1ull, 0xc584133ac916ab3cull, 0x3ee5789041c98ac3ull,
+    0xf3b8488c368cb0a6ull, 0x657eecdd3cb13d09ull, 0xc2d326e0055bdef6ull,
+    0x8621a03fe0bbdb7bull, 0x8e1f7555983aa92full, 0xb54e0f1600cc4d19ull,
+    0x84bb3f97971d80abull, 0x7d29825c75521255ull, 0xc3cf17102b7f7f86ull,
+    0x3466e9a083914f64ull, 0xd81a8d2b5a4485acull, 0xdb01602b100b9ed7ull,
+    0xa9038a921825f10dull, 0xedf5f1d90dca2f6aull, 0x54496ad67bd2634cull,
+    0xdd7c01d4f5407269ull, 0x935e82f1db4c4f7bull, 0x69b82ebc92233300ull,
+    0x40d29eb57de1d510ull, 0xa2f09dabb45c6316ull, 0xee521d7a0f4d3872ull,
+    0xf16952ee72f3454full, 0x377d35dea8e40225ull, 0x0c7de8064963bab0ull,
+    0x05582d37111ac529ull, 0xd254741f599dc6f7ull, 0x69630f7593d108c3ull,
+    0x417ef96181daa383ull, 0x3c3c41a3b43343a1ull, 0x6e19905dcbe531dfull,
+    0x4fa9fa7324851729ull, 0x84eb4454a792922aull, 0x134f7096918175ceull,
+    0x07dc930b302278a8ull, 0x12c015a97019e937ull, 0xcc06c31652ebf438ull,
+    0xecee65630a691e37ull, 0x3e84ecb1763e79adull, 0x690ed476743aae49ull,
+    0x774615d7b1a1f2e1ull, 0x22b353f04f4f52daull, 0xe3ddd86ba71a5eb1ull,
+    0xdf268adeb6513356ull, 0x2098eb73d4367d77ull, 0x03d6845323ce3c71ull,
+    0xc952c5620043c714ull, 0x9b196bca844f1705ull, 0x30260345dd9e0ec1ull,
+    0xcf448a5882bb9698ull, 0xf4a578dccbc87656ull, 0xbfdeaed9a17b3c8full,
+    0xed79402d1d5c5d7bull, 0x55f070ab1cbbf170ull, 0x3e00a34929a88f1dull,
+    0xe255b237b8bb18fbull, 0x2a7b67af6c6ad50eull, 0x466d5e7f3e46f143ull,
+    0x42375cb399a4fc72ull, 0x8c8a1f148a8bb259ull, 0x32fcab5daed5bdfcull,
+    0x9e60398c8d8553c0ull, 0xee89cceb8c4064c0ull, 0xdb0215941d86a66full,
+    0x5ccde78203c367a8ull, 0xf1bcbc6a1ec11786ull, 0xef054fceee954551ull,
+    0xdf82012d0555c6dfull, 0x292566ff72403c08ull, 0xc4dd302a1bfa1137ull,
+    0xd85f219db5c554e1ull, 0x6a27ff807441bcd2ull, 0x96a573e9b48216e8ull,
+    0x46a9fdac40bf0048ull, 0x3dd12464a0ee15b4ull, 0x451e521296a7eea1ull,
+    0x56e4398a98f8a0fdull, 0x7b7dc2160e3335a7ull, 0xc679ee0bebcb1ccaull,
+    0x928d6f2d7453424eull, 0x1b38994205234c6dull, 0x8086d193a6f2b568ull,
+    0x21c6e26639ac2c65ull, 0xd9dccac414d23c6full, 0x91cd642057e00235ull,
+    0x77fc607dc6589373ull, 0x05b8abe26dd3aee7ull, 0x12f6436ac376cc66ull,
+    0x64952424897b2307ull, 0xee8c2baf6343e5c3ull, 0xdc4c613d9eba2304ull,
+    0x3505b7796bd1a506ull, 0x8176daf800a05f50ull, 0x8bd8ff7a0385cdbcull,
+    0x1a764a3cd78101daull, 0xbe4d15bf6ca266acull, 0xa85e1f38bb2dc749ull,
+    0x56759a968493cd8cull, 0xf3a9bce7336bd182ull, 0x365b15013741519bull,
+    0x1f7a44a6b109ac94ull, 0x3521d628813cb177ull, 0x6a77afab0f7c9370ull,
+    0x179642d8cde95015ull, 0x5ef102a8fb354461ull, 0xf51c504764ed82f2ull,
+    0xc58427f041ce6808ull, 0xfad8fc45c9643c37ull, 0xcf8682f9a70fa9c0ull,
+    0x7e1b3b75a4005729ull, 0x992dd867927b52d8ull, 0x7fbd5db142f6791full,
+    0x370595aacab4adaeull, 0xb1392dbdc5ab61d6ull, 0x9fea7dfc79d452d9ull,
+    0x40b12b120085641cull, 0xa192afe3157c85d0ull, 0xc847729f4e08f3a3ull,
+    0x6f1384a306c41fc2ull, 0x12d05c4045a39c19ull, 0x9899202fd20f0841ull,
+    0xe9c7191857e774b8ull, 0x4eead809af5b0cc3ull, 0xe809acafa23864a4ull,
+    0x4da1edaba1d0f7bdull, 0x846eb9673349f8e4ull, 0x87bae55b86039fe8ull,
+    0x7f367b8bd953eff2ull, 0x3884700f650d04e1ull, 0xbfe4b2ab46980cadull,
+    0xc5fc89075299106cull, 0x37b2fa361adea7cdull, 0x7d75d813f04895b4ull,
+    0x702f5b393f62c0e0ull, 0x0a3fc775f4ecf37full, 0xe4b23787a352437full,
+    0xf83fa245c34d6363ull, 0xb99bcf040786cf50ull, 0x38b6ea0a0e6c9d8aull,
+    0x093fdc76776e37e1ull, 0x1a75e6f76ba7eee8ull, 0x442cdcfee9660c62ull,
+    0x22d58d35116b5e0bull, 0x87d4a5180f6a3645ull, 0x589fb216bd82131bull,
+    0x91d031cad319aec0ull, 0xabecf76a553d320bull, 0xb8686cb347612dcfull,
+    0xfcab66337c0a77f5ull, 0xac318214381ec437ull, 0x6eb7f0fca24494aeull,
+    0xcf42861dcdc895a9ull, 0x4abad7a1586d7a91ull, 0xc21b318dc2f49745ull,
+    0xd49474dc2acbd1f0ull, 0xb1d4873747c1c8e1ull, 0x5434dc8c7d015bf6ull,
+    0xe1c486287511b6a9ull, 0xa8616df62e89a193ull, 0x31ce6319498d8347ull,
+    0xafd0b486123d6faaull, 0xe6495f5d102301ebull, 0x0dc51ced17a43c52ull,
+    0x8bcbcde81355ef2dull, 0x2412af73fdee7cfcull, 0xc8d589e486e29eedull,
+    0x23390e8664517f89ull, 0x251ade58e8a6849dull, 0xf8555dbd2e8f9cb0ull,
+    0xcb417c3eef54f7c3ull, 0x8028f8e1aac3a919ull, 0x10e31052acf748a0ull,
+    0x2d886c073b1e1b78ull, 0x972974d90df9faeeull, 0xbc1b7b38796893baull,
+    0x1958ed432070e652ull, 0xca5f297197a12dccull, 0xe025a27375704f28ull,
+    0x418010a570a924fbull, 0x9828e2941bfc419cull, 0x4fbacd2f52b85c1full,
+    0x33dd5b756211cc67ull, 0x23c8dfdd1db57ff0ull, 0x32f81801a1a8e901ull,
+    0x26884eac5ada36daull, 0xcaa82f9bb42e37d4ull, 0x19fb1a7491d6a7d1ull,
+    0x5aa0243aa357f38eull, 0xb31d917809e447f0ull, 0x3f9c197225215be0ull,
+    0xdc3c315a1e33c095ull, 0x3dd399ad533e80acull, 0x566f32cce8301d95ull,
+    0xc880188083d9ba21ull, 0xb9cc357f3b0e7d2eull, 0x0237d2123a8a8d6cull,
+    0xbf636e9aa7cbf6bdull, 0xd7bd4284c4e2a6a7ull, 0xda2ebb47d50577a9ull,
+    0x90ba1c11b539087dull, 0x44993d31552b4f57ull, 0x32c2d6f80a8a8898ull,
+    0x450583ed7fb54b19ull, 0xec2b0b09e50ef3efull, 0xd918a0b6e2efd65cull,
+    0xe37a868d9785f572ull, 0x7d1a6118f2b0f37aull, 0x9e2e3cc13b343439ull,
+    0xefd82c11212e37e8ull, 0xaf89c05cd4fc75edull, 0x55bc16bb9697108eull,
+    0x6c4701fa5db69beeull, 0x9237338441daf445ull, 0x248cf0831e81a5fcull,
+    0xacc13557e77de273ull, 0x520970c25e06513aull, 0x657329cb02987cabull,
+    0xa9b0b3366a4e55a8ull, 0xc4d06ca2f39acdd4ull, 0x5dce37d68170cde1ull,
+    0x5f1e44e77e1854c9ull, 0x6883d452d55df899ull, 0x05c5bd62f1067032ull,
+    0xe680b683ce60fab0ull, 0x5dc9da3f286d18b1ull, 0x94b4bf3ab85ed6d8ull,
+    0xce65f449e3acc5a3ull, 0x34b0209642cea639ull, 0xc14c3c771d904827ull,
+    0x6addcee2bd9cdee5ull, 0xe24eed137ffbb613ull, 0x75dd58ef79963d1bull,
+    0xfdb83ecf6cc24920ull, 0x7a1d0057c57169fbull, 0x339200f4feb62d07ull,
+    0xd33f4d4ac88469f4ull, 0x8226f234e68dfee4ull, 0x320def4f2a105536ull,
+    0x7786f3b13aefc159ull, 0xb28225ac9df63ee2ull, 0x781b9d0376cc6044ull,
+    0x05bd0115226c6ab6ull, 0xd302230207bdfdabull, 0xdb898abd8e0d2933ull,
+    0x9e79a397ba00b9ccull, 0x89df84a5f0003ee8ull, 0x011f04f2a75fb9beull,
+    0x5a5832bb47bcf19eull,
+};
+
+typedef struct {
+  uint64_t hash;
+  uint32_t size;
+} Chunk;
+
+// Adds a consumed character, returning true if the chunk can end after it.
+static inline bool chunk_advance(Chunk *self, int32_t c) {
+  self->hash = (self->hash << 1) + CHUNK_GEAR[c & 0xFF];
+  self->size++;
+  if (self->size < CHUNK_MIN_SIZE)
+    return false;
+  return self->size >= CHUNK_MAX_SIZE ||
+         self->hash >> (64 - CHUNK_HASH_BITS) == 0;
+}
+
+static bool scan_whitespace(TSLexer *lexer) {
+  do {
+    lexer->advance(lexer, false);
+  } while (char_is_space(lexer->lookahead));
+  lexer->result_symbol = WHITESPACE;
   lexer->mark_end(lexer);
   return true;
 }
 
-// Generic JSP scanner that scans until %> and sets the appropriate token
-static bool scan_jsp_until_close(TSLexer *lexer, enum TokenType token_type) {
-  while (lexer->lookahead) {
-    if (lexer->lookahead == '%') {
-      lexer->advance(lexer, false);
-      if (lexer->lookahead == '>') {
-        lexer->advance(lexer, false);
-        lexer->result_symbol = token_type;
-        lexer->mark_end(lexer);
-        return true;
-      }
-    } else {
-      lexer->advance(lexer, false);
-    }
+static inline void skip_directive_space(TSLexer *lexer) {
+  while (char_is_space(lexer->lookahead)) {
+    lexer->advance(lexer, false);
   }
-  return false;
 }
 
-static bool scan_jsp_scriptlet(TSLexer *lexer) {
-  return scan_jsp_until_close(lexer, JSP_SCRIPTLET);
+// Reads a directive or attribute name made of ASCII letters into `buffer`,
+// returning its length, or 0 if it does not fit.
+static unsigned scan_directive_word(TSLexer *lexer, char *buffer,
+                                    unsigned buffer_size) {
+  unsigned length = 0;
+  while (char_is_alnum(lexer->lookahead) && lexer->lookahead < 0x80) {
+    if (length == buffer_size)
+      return 0;
+    buffer[length++] = (char)lexer->lookahead;
+    lexer->advance(lexer, false);
+  }
+  return length;
 }
 
-static bool scan_jsp_expression(TSLexer *lexer) {
-  return scan_jsp_until_close(lexer, JSP_EXPRESSION);
-}
+// Reads the attributes of a taglib directive, past the end of the token, and
+// records the prefix it declares. The grammar parses the directive itself.
+static void scan_taglib_directive(Scanner *scanner, TSLexer *lexer) {
+  for (;;) {
+    char name[16];
+    skip_directive_space(lexer);
+    unsigned name_length = scan_directive_word(lexer, name, sizeof(name));
+    if (name_length == 0)
+      return;
+    skip_directive_space(lexer);
+    if (lexer->lookahead != '=')
+      return;
+    lexer->advance(lexer, false);
+    skip_directive_space(lexer);
+    int32_t quote = lexer->lookahead;
+    if (quote != '"' && quote != '\'')
+      return;
+    lexer->advance(lexer, false);
 
-static bool scan_jsp_declaration(TSLexer *lexer) {
-  return scan_jsp_until_close(lexer, JSP_DECLARATION);
+    char value[TAGLIB_PREFIX_MAX_LENGTH * 4];
+    unsigned value_length = 0;
+    bool is_prefix = name_length == 6 && memcmp(name, "prefix", 6) == 0;
+    while (lexer->lookahead != quote) {
+      if (!lexer->lookahead)
+        return;
+      if (is_prefix) {
+        size_t written =
+            encode_utf8(char_to_upper(lexer->lookahead), &value[value_length],
+                        sizeof(value) - value_length);
+        if (written == 0)
+          return;
+        value_length += written;
+      }
+      lexer->advance(lexer, false);
+    }
+    lexer->advance(lexer, false);
+    if (is_prefix) {
+      scanner_add_taglib_prefix(scanner, value, value_length);
+      return;
+    }
+  }
 }
 
-static bool scan_jsp_comment(TSLexer *lexer) {
-  // We've already seen <%-, now check for second - and scan until --%>
-  if (lexer->lookahead != '-') {
-    return false;
+static bool scan_jsp_directive_start(Scanner *scanner, TSLexer *lexer) {
+  // We've already seen <%@. The token ends here; the grammar parses the
+  // rest, but a taglib directive is read ahead for its prefix.
+  lexer->result_symbol = JSP_DIRECTIVE_START;
+  lexer->mark_end(lexer);
+
+  char name[8];
+  skip_directive_space(lexer);
+  unsigned name_length = scan_directive_word(lexer, name, sizeof(name));
+  if (name_length == 6 && memcmp(name, "taglib", 6) == 0) {
+    scan_taglib_directive(scanner, lexer);
   }
-  lexer->advance(lexer, false);
+  return true;
+}
 
-  // Now scan until we find --%>
+// Scans a chunk of the Java code of a scriptlet, expression or declaration,
+// up to the closing "%>", which the grammar matches on its own. Like the JSP
+// compiler, this does not look into Java string literals.
+static bool scan_java_content(TSLexer *lexer) {
+  Chunk chunk = {0, 0};
+  bool has_content = false;
   while (lexer->lookahead) {
-    if (lexer->lookahead == '-') {
+    int32_t c = lexer->lookahead;
+    if (c == '%') {
+      lexer->mark_end(lexer);
       lexer->advance(lexer, false);
-      if (lexer->lookahead == '-') {
-        lexer->advance(lexer, false);
-        if (lexer->lookahead == '%') {
-          lexer->advance(lexer, false);
-          if (lexer->lookahead == '>') {
-            lexer->advance(lexer, false);
-            lexer->result_symbol = JSP_COMMENT;
-            lexer->mark_end(lexer);
-            return true;
-          }
-          // If we don't find '>', continue scanning
-        }
-        // If we don't find '%', continue scanning
-      }
-      // If we don't find second '-', continue scanning
+      if (lexer->lookahead == '>')
+        break;
     } else {
       lexer->advance(lexer, false);
     }
+    has_content = true;
+    if (chunk_advance(&chunk, c)) {
+      lexer->mark_end(lexer);
+      break;
+    }
   }
-  return false;
+  if (!lexer->lookahead)
+    lexer->mark_end(lexer);
+
+  lexer->result_symbol = JAVA_CONTENT;
+  return has_content;
 }
 
-static bool scan_el_expression(TSLexer *lexer) {
-  // We've already seen ${, now scan until }
-  int brace_count = 1;
-  while (lexer->lookahead && brace_count > 0) {
-    if (lexer->lookahead == '{') {
-      brace_count++;
-    } else if (lexer->lookahead == '}') {
-      brace_count--;
-    }
+// Scans a chunk of a JSP comment up to and including its "--%>". The last
+// chunk, or the whole comment when it is short, is `end_symbol`. An
+// unterminated comment runs to the end of the input. Failing instead would
+// have tree-sitter rescan to the end from every nearby position it tries
+// during error recovery.
+static bool scan_jsp_comment_body(TSLexer *lexer, enum TokenType end_symbol) {
+  Chunk chunk = {0, 0};
+  unsigned dashes = 0;
+  while (lexer->lookahead) {
+    int32_t c = lexer->lookahead;
     lexer->advance(lexer, false);
+    if (c == '-') {
+      // Never split the closing delimiter.
+      ++dashes;
+      chunk_advance(&chunk, c);
+      continue;
+    }
+    if (c == '%' && dashes >= 2 && lexer->lookahead == '>') {
+      lexer->advance(lexer, false);
+      break;
+    }
+    dashes = 0;
+    if (chunk_advance(&chunk, c) && lexer->lookahead) {
+      lexer->mark_end(lexer);
+      lexer->result_symbol = JSP_COMMENT_CHUNK;
+      return true;
+    }
   }
 
-  if (brace_count == 0) {
-    lexer->result_symbol = EL_EXPRESSION;
-    lexer->mark_end(lexer);
-    return true;
+  lexer->result_symbol = end_symbol;
+  lexer->mark_end(lexer);
+  return true;
+}
+
+static bool scan_jsp_comment(TSLexer *lexer) {
+  // We've already seen <%-, now check for the second -
+  if (lexer->lookahead != '-') {
+    return false;
   }
-  return false;
+  lexer->advance(lexer, false);
+  return scan_jsp_comment_body(lexer, JSP_COMMENT);
 }
 
-static bool scan_jsp_construct(TSLexer *lexer) {
+// Called after the opening "${" or "#{" of an EL expression, which becomes
+// the token; the grammar parses the expression and its closing brace.
+static bool scan_el_expression_start(TSLexer *lexer) {
+  lexer->result_symbol = EL_EXPRESSION_START;
+  lexer->mark_end(lexer);
+  return true;
+}
+
+static bool scan_jsp_construct(Scanner *scanner, TSLexer *lexer) {
   // We've seen <%, now check what follows
   if (lexer->lookahead == '@') {
     lexer->advance(lexer, false);
-    return scan_jsp_directive_start(lexer);
+    return scan_jsp_directive_start(scanner, lexer);
   } else if (lexer->lookahead == '=') {
     lexer->advance(lexer, false);
-    return scan_jsp_expression(lexer);
+    lexer->result_symbol = JSP_EXPRESSION_START;
   } else if (lexer->lookahead == '!') {
     lexer->advance(lexer, false);
-    return scan_jsp_declaration(lexer);
+    lexer->result_symbol = JSP_DECLARATION_START;
   } else if (lexer->lookahead == '-') {
     lexer->advance(lexer, false);
     return scan_jsp_comment(lexer);
   } else {
-    return scan_jsp_scriptlet(lexer);
+    lexer->result_symbol = JSP_SCRIPTLET_START;
+  }
+  // The grammar parses the body and the closing %>
+  lexer->mark_end(lexer);
+  return true;
+}
+
+// Scans the text of a quoted attribute value up to its closing quote, or up to
+// a JSP construct or EL expression inside it, which is scanned instead when it
+// comes first. A '<', '$' or '#' that opens neither is text, and as in
+// template text, "\\${" and "\\#{" are literal text.
+static bool scan_attribute_text(Scanner *scanner, TSLexer *lexer,
+                                const ScanMode *mode) {
+  enum TokenType symbol = mode_allows(mode, DOUBLE_QUOTED_ATTRIBUTE_TEXT)
+                              ? DOUBLE_QUOTED_ATTRIBUTE_TEXT
+                              : SINGLE_QUOTED_ATTRIBUTE_TEXT;
+  int32_t quote = symbol == DOUBLE_QUOTED_ATTRIBUTE_TEXT ? '"' : '\'';
+
+  bool has_text = false;
+  for (;; has_text = true) {
+    int32_t c = lexer->lookahead;
+    if (c == 0 || c == quote) {
+      lexer->mark_end(lexer);
+      break;
+    }
+    if (c == '\\') {
+      lexer->advance(lexer, false);
+      if (lexer->lookahead == '$' || lexer->lookahead == '#')
+        lexer->advance(lexer, false);
+      continue;
+    }
+    if (c != '<' && c != '$' && c != '#') {
+      lexer->advance(lexer, false);
+      continue;
+    }
+
+    lexer->mark_end(lexer);
+    lexer->advance(lexer, false);
+    if (lexer->lookahead == (c == '<' ? '%' : '{')) {
+      if (has_text)
+        break;
+      lexer->advance(lexer, false);
+      return c == '<' ? scan_jsp_construct(scanner, lexer)
+                      : scan_el_expression_start(lexer);
+    }
+  }
+
+  if (!has_text)
+    return false;
+  lexer->result_symbol = symbol;
+  return true;
+}
+
+// Scans a chunk of an HTML comment up to and including its "-->", like
+// scan_jsp_comment_body. As in HTML, an unterminated comment runs to the end
+// of the input.
+static bool scan_comment_body(TSLexer *lexer, enum TokenType end_symbol) {
+  Chunk chunk = {0, 0};
+  unsigned dashes = 0;
+  while (lexer->lookahead) {
+    int32_t c = lexer->lookahead;
+    lexer->advance(lexer, false);
+    if (c == '-') {
+      ++dashes;
+      chunk_advance(&chunk, c);
+      continue;
+    }
+    if (c == '>' && dashes >= 2)
+      break;
+    dashes = 0;
+    if (chunk_advance(&chunk, c) && lexer->lookahead) {
+      lexer->mark_end(lexer);
+      lexer->result_symbol = COMMENT_CHUNK;
+      return true;
+    }
   }
+
+  lexer->result_symbol = end_symbol;
+  lexer->mark_end(lexer);
+  return true;
 }
 
 static bool scan_comment(TSLexer *lexer) {
@@ -282,59 +1233,171 @@ static bool scan_comment(TSLexer *lexer) {
   if (lexer->lookahead != '-')
     return false;
   lexer->advance(lexer, false);
+  return scan_comment_body(lexer, COMMENT);
+}
 
-  unsigned dashes = 0;
-  while (lexer->lookahead) {
-    switch (lexer->lookahead) {
-    case '-':
-      ++dashes;
-      break;
-    case '>':
-      if (dashes >= 2) {
-        lexer->result_symbol = COMMENT;
-        lexer->advance(lexer, false);
-        lexer->mark_end(lexer);
-        return true;
-      }
-      // fallthrough
-    default:
-      dashes = 0;
-    }
+// Consumes `keyword`, matched ASCII case-insensitively when `fold` is set.
+static bool scan_keyword(TSLexer *lexer, const char *keyword, bool fold) {
+  for (; *keyword; keyword++) {
+    int32_t c = fold ? char_to_upper(lexer->lookahead) : lexer->lookahead;
+    if (c != (unsigned char)*keyword)
+      return false;
     lexer->advance(lexer, false);
   }
-  return false;
+  return true;
 }
 
-static bool scan_raw_text(Scanner *scanner, TSLexer *lexer) {
-  if (scanner->tags.size == 0)
-    return false;
+// Scans up to and including `terminator`, or to the end of the input like an
+// unterminated comment. A terminator is a run of one character and then a
+// different one, as in "]]>", so after a mismatch on the run's character the
+// match in progress is unchanged, and after any other mismatch it is empty.
+static bool scan_until(TSLexer *lexer, const char *terminator,
+                       enum TokenType symbol) {
+  unsigned matched = 0;
+  while (lexer->lookahead && terminator[matched]) {
+    int32_t c = lexer->lookahead;
+    lexer->advance(lexer, false);
+    if (c == (unsigned char)terminator[matched]) {
+      matched++;
+    } else if (c != (unsigned char)terminator[0]) {
+      matched = 0;
+    }
+  }
+  lexer->result_symbol = symbol;
+  lexer->mark_end(lexer);
+  return true;
+}
 
-  // Check if we're inside a script or style tag
-  Tag *current_tag = &scanner->tags.contents[scanner->tags.size - 1];
-  if (current_tag->type != SCRIPT && current_tag->type != STYLE)
+// Called after "<!": a comment, a "<!DOCTYPE ...>" or a CDATA section.
+static bool scan_markup_declaration(TSLexer *lexer, const ScanMode *mode) {
+  switch (lexer->lookahead) {
+  case '-':
+    return scan_comment(lexer);
+  case '[':
+    if (!mode_allows(mode, CDATA_SECTION) ||
+        !scan_keyword(lexer, "[CDATA[", false))
+      return false;
+    return scan_until(lexer, "]]>", CDATA_SECTION);
+  default:
+    if (!mode_allows(mode, DOCTYPE) || !scan_keyword(lexer, "DOCTYPE", true))
+      return false;
+    return scan_until(lexer, ">", DOCTYPE);
+  }
+}
+
+// Raw text ends at "</" followed by the upper-cased name of the element. Tag
+// names cannot contain '<', so the KMP failure function is trivial: after a
+// mismatch the only match that can still be in progress is a new one starting
+// at the mismatching character, if it is '<'.
+static inline char raw_text_delimiter_char(const char *name, unsigned i) {
+  return i == 0 ? '<' : i == 1 ? '/' : name[i - 2];
+}
+
+// Scans raw text up to the end tag of the element, or up to a JSP construct
+// or EL expression inside it, which are scanned instead when they come first.
+// As in JSP template text, "\\${" and "\\#{" are literal text.
+static bool scan_raw_text(Scanner *scanner, TSLexer *lexer,
+                          const ScanMode *mode) {
+  if (!inside_raw_text_element(scanner))
     return false;
 
-  lexer->mark_end(lexer);
+  const Tag *current_tag = array_back(&scanner->tags);
+  const char *name;
+  unsigned name_length;
+  if (current_tag->type == SCRIPT) {
+    name = "SCRIPT";
+    name_length = 6;
+  } else if (current_tag->type == STYLE) {
+    name = "STYLE";
+    name_length = 5;
+  } else {
+    name = tag_names_get(&scanner->names, current_tag->name_id, &name_length);
+  }
+  unsigned delimiter_length = name_length + 2;
+  bool jsp_allowed = mode_allows(mode, JSP_SCRIPTLET_START);
+  bool el_allowed = mode_allows(mode, EL_EXPRESSION_START);
 
-  const char *end_delimiter =
-      current_tag->type == SCRIPT ? "</SCRIPT" : "</STYLE";
+  lexer->mark_end(lexer);
 
-  unsigned delimiter_index = 0;
+  Chunk chunk = {0, 0};
+  bool has_content = false;
+  unsigned matched = 0;
   while (lexer->lookahead) {
-    if (towupper(lexer->lookahead) == end_delimiter[delimiter_index]) {
-      delimiter_index++;
-      if (delimiter_index == strlen(end_delimiter))
+    int32_t c = lexer->lookahead;
+    if (matched == 0 && c != '<' && c != '$' && c != '#' && c != '\\') {
+      // Nothing can match or open a construct before the next of these.
+      bool boundary;
+      do {
+        c = lexer->lookahead;
+        lexer->advance(lexer, false);
+        boundary = chunk_advance(&chunk, c);
+      } while (!boundary && lexer->lookahead && lexer->lookahead != '<' &&
+               lexer->lookahead != '$' && lexer->lookahead != '#' &&
+               lexer->lookahead != '\\');
+      lexer->mark_end(lexer);
+      has_content = true;
+      if (boundary)
         break;
+      continue;
+    }
+
+    if (c == '<') {
+      // Any partial match so far is text; a new one starts here.
+      lexer->mark_end(lexer);
+      has_content |= chunk.size > 0;
       lexer->advance(lexer, false);
+      if (lexer->lookahead == '%' && jsp_allowed) {
+        if (has_content)
+          break;
+        lexer->advance(lexer, false);
+        return scan_jsp_construct(scanner, lexer);
+      }
+      chunk_advance(&chunk, c);
+      matched = 1;
+      continue;
+    }
+
+    if (matched > 0) {
+      if (char_to_upper(c) ==
+          (unsigned char)raw_text_delimiter_char(name, matched)) {
+        lexer->advance(lexer, false);
+        chunk_advance(&chunk, c);
+        if (++matched == delimiter_length)
+          break;
+        continue;
+      }
+      matched = 0;
+    }
+
+    if ((c == '$' || c == '#') && el_allowed) {
+      lexer->mark_end(lexer);
+      lexer->advance(lexer, false);
+      if (lexer->lookahead == '{') {
+        if (chunk.size > 0) {
+          has_content = true;
+          break;
+        }
+        lexer->advance(lexer, false);
+        return scan_el_expression_start(lexer);
+      }
     } else {
-      delimiter_index = 0;
       lexer->advance(lexer, false);
-      lexer->mark_end(lexer);
+      if (c == '\\' && (lexer->lookahead == '$' || lexer->lookahead == '#')) {
+        chunk_advance(&chunk, c);
+        c = lexer->lookahead;
+        lexer->advance(lexer, false);
+      }
     }
+    // A chunk can only end where no match is in progress.
+    bool boundary = chunk_advance(&chunk, c);
+    lexer->mark_end(lexer);
+    has_content = true;
+    if (boundary)
+      break;
   }
 
   lexer->result_symbol = RAW_TEXT;
-  return true;
+  return has_content;
 }
 
 static bool scan_implicit_end_tag(Scanner *scanner, TSLexer *lexer) {
@@ -347,58 +1410,53 @@ static bool scan_implicit_end_tag(Scanner *scanner, TSLexer *lexer) {
     is_closing_tag = true;
     lexer->advance(lexer, false);
   } else {
-    if (parent && tag_is_void(parent)) {
-      array_pop(&scanner->tags);
+    if (parent && scanner_tag_is_void(scanner, parent)) {
+      scanner_pop_tag(scanner);
       lexer->result_symbol = IMPLICIT_END_TAG;
       return true;
     }
   }
 
-  char tag_name[256];
-  scan_tag_name(lexer, tag_name, sizeof(tag_name));
-  if (tag_name[0] == '\0')
+  char name[256];
+  unsigned name_length = scan_tag_name(lexer, name, sizeof(name), NULL);
+  if (name_length == 0)
     return false;
 
-  Tag next_tag = create_tag_from_name(tag_name);
+  Tag tag = tag_find_for_name(&scanner->names, name, name_length);
 
   if (is_closing_tag) {
     // The tag correctly closes the topmost element on the stack
     if (scanner->tags.size > 0 &&
-        tag_eq(&scanner->tags.contents[scanner->tags.size - 1], &next_tag)) {
-      tag_free(&next_tag);
+        tag_eq(&scanner->tags.contents[scanner->tags.size - 1], &tag)) {
       return false;
     }
 
-    // Otherwise, dig deeper and queue implicit end tags
-    for (uint32_t i = 0; i < scanner->tags.size; i++) {
-      if (tag_eq(&scanner->tags.contents[i], &next_tag)) {
-        tag_free(&scanner->tags.contents[scanner->tags.size - 1]);
-        array_pop(&scanner->tags);
-        lexer->result_symbol = IMPLICIT_END_TAG;
-        tag_free(&next_tag);
-        return true;
-      }
+    // Otherwise, if the tag is open further down, queue implicit end tags
+    if (scanner_tag_is_open(scanner, &tag)) {
+      scanner_pop_tag(scanner);
+      lexer->result_symbol = IMPLICIT_END_TAG;
+      return true;
     }
-  } else if (parent && !tag_can_contain(parent, &next_tag)) {
-    tag_free(&scanner->tags.contents[scanner->tags.size - 1]);
-    array_pop(&scanner->tags);
+  } else if (parent && !tag_can_contain(parent, tag.type)) {
+    scanner_pop_tag(scanner);
     lexer->result_symbol = IMPLICIT_END_TAG;
-    tag_free(&next_tag);
     return true;
   }
 
-  tag_free(&next_tag);
   return false;
 }
 
-static bool scan_start_tag_name(Scanner *scanner, TSLexer *lexer) {
-  char tag_name[256];
-  scan_tag_name(lexer, tag_name, sizeof(tag_name));
-  if (tag_name[0] == '\0')
+static bool scan_start_tag_name(Scanner *scanner, TSLexer *lexer,
+                                const ScanMode *mode) {
+  char name[256];
+  unsigned prefix_length;
+  unsigned name_length =
+      scan_tag_name(lexer, name, sizeof(name), &prefix_length);
+  if (name_length == 0)
     return false;
 
-  Tag tag = create_tag_from_name(tag_name);
-  array_push(&scanner->tags, tag);
+  Tag tag = tag_for_name(&scanner->names, name, name_length);
+  scanner_push_tag(scanner, tag);
 
   switch (tag.type) {
   case TEMPLATE:
@@ -410,6 +1468,16 @@ static bool scan_start_tag_name(Scanner *scanner, TSLexer *lexer) {
   case STYLE:
     lexer->result_symbol = STYLE_START_TAG_NAME;
     break;
+  case CUSTOM:
+    if (scanner_custom_tag_kind(scanner, &tag) == CUSTOM_TAG_RAW_TEXT) {
+      lexer->result_symbol = RAW_TEXT_START_TAG_NAME;
+    } else if (mode_allows(mode, TAGLIB_START_TAG_NAME) &&
+               scanner_is_taglib_name(scanner, name, name_length)) {
+      lexer->result_symbol = TAGLIB_START_TAG_NAME;
+    } else {
+      lexer->result_symbol = START_TAG_NAME;
+    }
+    break;
   default:
     lexer->result_symbol = START_TAG_NAME;
     break;
@@ -418,21 +1486,37 @@ static bool scan_start_tag_name(Scanner *scanner, TSLexer *lexer) {
 }
 
 static bool scan_end_tag_name(Scanner *scanner, TSLexer *lexer) {
-  char tag_name[256];
-  scan_tag_name(lexer, tag_name, sizeof(tag_name));
-  if (tag_name[0] == '\0')
+  char name[256];
+  unsigned prefix_length;
+  unsigned name_length =
+      scan_tag_name(lexer, name, sizeof(name), &prefix_length);
+  if (name_length == 0)
     return false;
 
-  Tag tag = create_tag_from_name(tag_name);
+  Tag tag = tag_find_for_name(&scanner->names, name, name_length);
   if (scanner->tags.size > 0 &&
       tag_eq(&scanner->tags.contents[scanner->tags.size - 1], &tag)) {
-    tag_free(&scanner->tags.contents[scanner->tags.size - 1]);
-    array_pop(&scanner->tags);
+    scanner_pop_tag(scanner);
     lexer->result_symbol = END_TAG_NAME;
   } else {
+    // The erroneous name is a single node, prefix and all.
+    if (prefix_length > 0)
+      lexer->mark_end(lexer);
     lexer->result_symbol = ERRONEOUS_END_TAG_NAME;
   }
-  tag_free(&tag);
+  return true;
+}
+
+// The part of a namespaced tag name after the prefix. The colon is skipped
+// like whitespace, so it sits between the prefix and local name nodes.
+static bool scan_tag_local_name(TSLexer *lexer) {
+  lexer->advance(lexer, true);
+  if (!char_is_tag_name(lexer->lookahead))
+    return false;
+  while (char_is_tag_name(lexer->lookahead)) {
+    lexer->advance(lexer, false);
+  }
+  lexer->result_symbol = TAG_LOCAL_NAME;
   return true;
 }
 
@@ -441,8 +1525,7 @@ static bool scan_self_closing_tag_delimiter(Scanner *scanner, TSLexer *lexer) {
   if (lexer->lookahead == '>') {
     lexer->advance(lexer, false);
     if (scanner->tags.size > 0) {
-      tag_free(&scanner->tags.contents[scanner->tags.size - 1]);
-      array_pop(&scanner->tags);
+      scanner_pop_tag(scanner);
       lexer->result_symbol = SELF_CLOSING_TAG_DELIMITER;
     }
     return true;
@@ -451,32 +1534,10 @@ static bool scan_self_closing_tag_delimiter(Scanner *scanner, TSLexer *lexer) {
 }
 
 static bool scanner_scan(Scanner *scanner, TSLexer *lexer,
-                         const bool *valid_symbols) {
-  while (iswspace(lexer->lookahead)) {
-    lexer->advance(lexer, true);
-  }
-
-  // Check if we're inside a script or style tag - if so, prioritize raw_text
-  bool inside_script_or_style = false;
-  if (scanner->tags.size > 0) {
-    Tag *current_tag = &scanner->tags.contents[scanner->tags.size - 1];
-    inside_script_or_style =
-        (current_tag->type == SCRIPT || current_tag->type == STYLE);
-  }
-
-  // If we're inside script or style tags and raw_text is valid, scan for
-  // raw_text
-  if (inside_script_or_style && valid_symbols[RAW_TEXT]) {
-    return scan_raw_text(scanner, lexer);
-  }
-
-  // Original raw_text condition for other contexts
-  if (valid_symbols[RAW_TEXT] && !valid_symbols[START_TAG_NAME] &&
-      !valid_symbols[END_TAG_NAME] && !valid_symbols[JSP_DIRECTIVE_START] &&
-      !valid_symbols[JSP_SCRIPTLET] && !valid_symbols[JSP_EXPRESSION] &&
-      !valid_symbols[JSP_DECLARATION] && !valid_symbols[JSP_COMMENT] &&
-      !valid_symbols[EL_EXPRESSION]) {
-    return scan_raw_text(scanner, lexer);
+                         const ScanMode *mode, bool in_raw_text) {
+  // Inside script, style or a registered raw-text element
+  if (in_raw_text) {
+    return scan_raw_text(scanner, lexer, mode);
   }
 
   switch (lexer->lookahead) {
@@ -486,27 +1547,31 @@ static bool scanner_scan(Scanner *scanner, TSLexer *lexer,
 
     if (lexer->lookahead == '!') {
       lexer->advance(lexer, false);
-      return scan_comment(lexer);
+      return scan_markup_declaration(lexer, mode);
+    }
+
+    if (lexer->lookahead == '?' && mode_allows(mode, PROCESSING_INSTRUCTION)) {
+      lexer->advance(lexer, false);
+      return scan_until(lexer, "?>", PROCESSING_INSTRUCTION);
     }
 
     if (lexer->lookahead == '%') {
       lexer->advance(lexer, false);
-      return scan_jsp_construct(lexer);
+      return scan_jsp_construct(scanner, lexer);
     }
 
-    if (valid_symbols[IMPLICIT_END_TAG]) {
+    if (mode_allows(mode, IMPLICIT_END_TAG)) {
       return scan_implicit_end_tag(scanner, lexer);
     }
     break;
 
   case '$':
-    // Skip EL expression checking if we're inside script or style tags
-    if (valid_symbols[EL_EXPRESSION] && !inside_script_or_style) {
+    if (mode_allows(mode, EL_EXPRESSION_START)) {
       TSLexer saved_lexer = *lexer;
       lexer->advance(lexer, false);
       if (lexer->lookahead == '{') {
         lexer->advance(lexer, false);
-        return scan_el_expression(lexer);
+        return scan_el_expression_start(lexer);
       } else {
         // Not an EL expression, restore position
         *lexer = saved_lexer;
@@ -514,23 +1579,34 @@ static bool scanner_scan(Scanner *scanner, TSLexer *lexer,
     }
     break;
 
+  case '#':
+    // Deferred EL, as in JSF pages
+    if (mode_allows(mode, EL_EXPRESSION_START)) {
+      lexer->advance(lexer, false);
+      if (lexer->lookahead == '{') {
+        lexer->advance(lexer, false);
+        return scan_el_expression_start(lexer);
+      }
+    }
+    break;
+
   case '\0':
-    if (valid_symbols[IMPLICIT_END_TAG]) {
+    if (mode_allows(mode, IMPLICIT_END_TAG)) {
       return scan_implicit_end_tag(scanner, lexer);
     }
     break;
 
   case '/':
-    if (valid_symbols[SELF_CLOSING_TAG_DELIMITER]) {
+    if (mode_allows(mode, SELF_CLOSING_TAG_DELIMITER)) {
       return scan_self_closing_tag_delimiter(scanner, lexer);
     }
     break;
 
   default:
-    if ((valid_symbols[START_TAG_NAME] || valid_symbols[END_TAG_NAME]) &&
-        !valid_symbols[RAW_TEXT]) {
-      return valid_symbols[START_TAG_NAME] ? scan_start_tag_name(scanner, lexer)
-                                           : scan_end_tag_name(scanner, lexer);
+    if (mode->flags & MODE_TAG_NAME) {
+      return mode_allows(mode, START_TAG_NAME)
+                 ? scan_start_tag_name(scanner, lexer, mode)
+                 : scan_end_tag_name(scanner, lexer);
     }
   }
 
@@ -561,26 +1637,52 @@ void tree_sitter_jsp_external_scanner_deserialize(void *payload,
 bool tree_sitter_jsp_external_scanner_scan(void *payload, TSLexer *lexer,
                                            const bool *valid_symbols) {
   Scanner *scanner = (Scanner *)payload;
+  const ScanMode *mode = scanner_mode(scanner, valid_symbols);
+  SCANNER_STAT(calls);
 
-  // Check if we're inside a script or style tag
-  bool inside_script_or_style = false;
-  if (scanner->tags.size > 0) {
-    Tag *current_tag = &scanner->tags.contents[scanner->tags.size - 1];
-    inside_script_or_style =
-        (current_tag->type == SCRIPT || current_tag->type == STYLE);
+  // The scanner owns the whitespace between tokens, so each run is read once
+  // even where the next token is one of the grammar's own.
+  if ((mode->flags & MODE_WHITESPACE) && char_is_space(lexer->lookahead)) {
+    return scan_whitespace(lexer);
   }
 
-  bool is_error_recovery =
-      valid_symbols[START_TAG_NAME] && valid_symbols[RAW_TEXT];
-  if (!is_error_recovery) {
-    // Check for EL expressions first, before text fragment scanning
-    if (lexer->lookahead == '$' && valid_symbols[EL_EXPRESSION] &&
-        !inside_script_or_style) {
-      return scanner_scan(scanner, lexer, valid_symbols);
-    }
+  if (lexer->lookahead == ':' && mode_allows(mode, TAG_LOCAL_NAME) &&
+      !(mode->flags & MODE_ERROR_RECOVERY)) {
+    return scan_tag_local_name(lexer);
+  }
+
+  // Inside script, style or a registered raw-text element, where the body is
+  // raw text, JSP and EL
+  bool in_raw_text =
+      mode_allows(mode, RAW_TEXT) && inside_raw_text_element(scanner);
+
+  // Raw text can start anywhere; otherwise reject positions where no valid
+  // token can start.
+  if (!in_raw_text && !scan_mode_can_start(mode, lexer)) {
+    SCANNER_STAT(fast_rejections);
+    return false;
+  }
 
-    if (lexer->lookahead != '<' &&
-        (valid_symbols[TEXT_FRAGMENT] || valid_symbols[INTERPOLATION_TEXT])) {
+  if (mode->flags & MODE_JAVA_CONTENT) {
+    return scan_java_content(lexer);
+  }
+
+  if (mode->flags & MODE_ATTRIBUTE_TEXT) {
+    return scan_attribute_text(scanner, lexer, mode);
+  }
+
+  if (mode->flags & MODE_COMMENT_BODY) {
+    return scan_comment_body(lexer, COMMENT_TAIL);
+  }
+
+  if (mode->flags & MODE_JSP_COMMENT_BODY) {
+    return scan_jsp_comment_body(lexer, JSP_COMMENT_TAIL);
+  }
+
+  if (mode->flags & MODE_TEXT) {
+    // Template text runs up to the next tag, JSP construct or EL expression
+    // and is a single token.
+    if (lexer->lookahead != '<') {
       bool has_text = false;
       for (;; has_text = true) {
         if (lexer->lookahead == 0) {
@@ -589,14 +1691,19 @@ bool tree_sitter_jsp_external_scanner_scan(void *payload, TSLexer *lexer,
         } else if (lexer->lookahead == '<') {
           lexer->mark_end(lexer);
           break;
-        } else if (lexer->lookahead == '$' && !inside_script_or_style) {
-          // Only check for EL expressions if we're NOT inside script or style
-          // tags AND if EL_EXPRESSION is a valid symbol
-          if (valid_symbols[EL_EXPRESSION]) {
+        } else if (lexer->lookahead == '$' || lexer->lookahead == '#') {
+          // Only check for EL expressions if EL_EXPRESSION_START is a valid
+          // symbol
+          if (mode_allows(mode, EL_EXPRESSION_START)) {
             lexer->mark_end(
                 lexer); // Mark end BEFORE checking for EL expression
             lexer->advance(lexer, false);
             if (lexer->lookahead == '{') {
+              // The expression is the token if no text comes before it.
+              if (!has_text) {
+                lexer->advance(lexer, false);
+                return scan_el_expression_start(lexer);
+              }
               // This is an EL expression, break to return the text fragment
               break;
             } else {
@@ -605,22 +1712,14 @@ bool tree_sitter_jsp_external_scanner_scan(void *payload, TSLexer *lexer,
               // position
             }
           } else {
-            // EL_EXPRESSION is not valid, treat $ as regular text
+            // EL_EXPRESSION_START is not valid, treat $ as regular text
             lexer->advance(lexer, false);
           }
-        } else if (lexer->lookahead == '{') {
-          lexer->mark_end(lexer);
-          lexer->advance(lexer, false);
-          if (lexer->lookahead == '{')
-            break;
-        } else if (lexer->lookahead == '}' &&
-                   valid_symbols[INTERPOLATION_TEXT]) {
-          lexer->mark_end(lexer);
+        } else if (lexer->lookahead == '\\') {
+          // "\\${" and "\\#{" are literal text in JSP
           lexer->advance(lexer, false);
-          if (lexer->lookahead == '}') {
-            lexer->result_symbol = INTERPOLATION_TEXT;
-            return has_text;
-          }
+          if (lexer->lookahead == '$' || lexer->lookahead == '#')
+            lexer->advance(lexer, false);
         } else {
           lexer->advance(lexer, false);
         }
@@ -632,5 +1731,5 @@ bool tree_sitter_jsp_external_scanner_scan(void *payload, TSLexer *lexer,
     }
   }
 
-  return scanner_scan(scanner, lexer, valid_symbols);
+  return scanner_scan(scanner, lexer, mode, in_raw_text);
 }
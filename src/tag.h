@@ -1,5 +1,7 @@
+#include "tree_sitter/alloc.h"
 #include "tree_sitter/array.h"
 
+#include <stdint.h>
 #include <string.h>
 
 typedef enum {
@@ -136,8 +138,6 @@ typedef enum {
     END_,
 } TagType;
 
-typedef Array(char) String;
-
 typedef struct {
     char tag_name[16];
     TagType tag_type;
@@ -145,7 +145,8 @@ typedef struct {
 
 typedef struct {
     TagType type;
-    String custom_tag_name;
+    // Interned name of a CUSTOM tag, 0 for every other type.
+    uint32_t name_id;
 } Tag;
 
 static const TagMapEntry TAG_TYPES_BY_TAG_NAME[126] = {
@@ -277,48 +278,232 @@ static const TagMapEntry TAG_TYPES_BY_TAG_NAME[126] = {
     {"CUSTOM",     CUSTOM    },
 };
 
-static const TagType TAG_TYPES_NOT_ALLOWED_IN_PARAGRAPHS[] = {
-    ADDRESS,  ARTICLE,    ASIDE,  BLOCKQUOTE, DETAILS, DIV, DL,
-    FIELDSET, FIGCAPTION, FIGURE, FOOTER,     FORM,    H1,  H2,
-    H3,       H4,         H5,     H6,         HEADER,  HR,  MAIN,
-    NAV,      OL,         P,      PRE,        SECTION,
+// Perfect hash over the names in TAG_TYPES_BY_TAG_NAME. The key is the first
+// eight bytes of the upper-cased name packed little-endian, xor-ed with its
+// length; the slot is the top 9 bits of the key times the multiplier. Every
+// known name has a slot of its own holding its table index plus one, so a
+// lookup is one hash and one comparison. The multiplier was found by trying
+// random odd constants until no two names collided; bench/tag_lookup.c
+// checks the table against TAG_TYPES_BY_TAG_NAME.
+#define TAG_NAME_HASH_MULTIPLIER 0x97415ba190dab5e5ull
+#define TAG_NAME_HASH_BITS 9
+
+static const uint8_t TAG_NAME_HASH_SLOTS[1 << TAG_NAME_HASH_BITS] = {
+      0,   0,  39,   0,   0,   0, 119,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,  85,  34,   0,   0,  32,   0,   0,  98,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,  19,   0,  42,   0,   0,   0,   0,  74, 111,   0,   0,   0,   0,
+      0, 102,  84,   0,   0,   0,   0,   0,  56,   0,   0,   0,  92,   8, 106,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0, 124,  79,   0, 113,   0,   0,   0,   0,   0,   0,   6,
+      0,   0,   0, 117,   0,   0,  38,   0,   0,   0,  33,   2,   0,  88,   0,   0,
+      0,  47,   0,   0,   0,   0,  57,  77,   3,   7,   0,   0,   0,   0,  36,  86,
+      0,  61,   0,   0,   0, 112, 101, 125,  91,  81,   0,   0,   0,   0,   0,   0,
+      0,   0,  95,   0,   0,   0,   0,   0,  35,  27,   0,   0,  96,   0,   0,  78,
+      0,  75,   0,   0, 104,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,  40,
+     69,   0,   0,  53,   0,   0,   0,   0,   0,   0,   0,   0,   0,  48,  55,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0, 116,   0,   0,   0,   0,   0,
+      0,   0,  76,   0,   0,   0,   0,   0,   1,   9,  21,   0,  16,   0,   0, 118,
+      0,  68,   0,   0,   0,  97,   0,   0,   0,  28,  15,   0, 100,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,  58,   0, 115,   0,   0,  41,   0,
+     45,   0,   0,   0,  62,   4,   0,   0,   0,   0,   0,   0,   0,   0,  72,   0,
+      0,   0,   0,   0,  67,   0,   0,   0,   0,   0,   0,   0,   0,   0, 108,   0,
+      0,   0,   0, 120,   0,   0,   0,   0,   0,   0,  90,  14,  30,   0,   0, 107,
+      0,   0,   0,   0, 109,   0,   0,  51,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,  13, 122,   0,   0,   0, 110,  37,   0,   0,   0,   0,   0,   0,   0,   0,
+     10,   0,   0,   0,   0,   0, 105,   0,  89,   0,   0,   0,  11,   0,   0,   0,
+      0,  82,  93,   0,   0,   0,   0,  63, 103,   0,   0,   0,  94,   0,   0,   0,
+     43,   0,  73,   0,   0,  70,   0,   0,   0,  26,  46,   0,  59,   0, 121,   5,
+      0,   0,   0,   0,  20,   0,  49,   0,   0,  44,   0,   0,   0,   0,   0,  99,
+     22,   0,   0,   0,   0,   0,  12,   0,   0,   0,   0,  50, 123,   0,   0,   0,
+     24,   0,   0,   0,   0,   0,   0,   0,   0,  23,   0,   0,  18,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,  54,  87,   0,   0,  65,   0,   0,   0,  80,   0,
+     66,   0,   0,   0,   0,   0,   0,   0,   0,   0,  31,  83,   0,  71,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,  17,   0,   0,   0,   0,   0,   0,   0,
+     52,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, 114,   0,
+      0,   0,   0,   0,   0,   0,  64,   0,   0,   0,  29,   0,  25,   0,   0,  60,
 };
 
-static TagType tag_type_for_name(const String *tag_name) {
-    for (int i = 0; i < 126; i++) {
-        const TagMapEntry *entry = &TAG_TYPES_BY_TAG_NAME[i];
-        if (
-            strlen(entry->tag_name) == tag_name->size &&
-            memcmp(tag_name->contents, entry->tag_name, tag_name->size) == 0
-        ) {
-            return entry->tag_type;
-        }
+static inline uint32_t tag_name_hash(const char *name, unsigned length) {
+    uint64_t key = 0;
+    for (unsigned i = 0; i < length && i < 8; i++) {
+        key |= (uint64_t)(unsigned char)name[i] << (8 * i);
+    }
+    key ^= length;
+    return (uint32_t)((key * TAG_NAME_HASH_MULTIPLIER) >> (64 - TAG_NAME_HASH_BITS));
+}
+
+static TagType tag_type_for_name(const char *name, unsigned length) {
+    if (length == 0 || length >= sizeof(TAG_TYPES_BY_TAG_NAME[0].tag_name)) {
+        return CUSTOM;
+    }
+    uint8_t slot = TAG_NAME_HASH_SLOTS[tag_name_hash(name, length)];
+    if (slot == 0) {
+        return CUSTOM;
+    }
+    const TagMapEntry *entry = &TAG_TYPES_BY_TAG_NAME[slot - 1];
+    if (
+        entry->tag_name[length] == '\0' &&
+        memcmp(name, entry->tag_name, length) == 0
+    ) {
+        return entry->tag_type;
     }
     return CUSTOM;
 }
 
+// Interned custom tag names. Each distinct name is stored once per scanner
+// and identified by a small ID, so tags on the stack compare as integers.
+// ID 0 is never assigned and stands for "no name".
+typedef struct {
+    Array(char) chars;
+    // Name `id` spans chars[offsets[id - 1]] .. chars[offsets[id]].
+    Array(uint32_t) offsets;
+    // Open-addressing hash table of IDs, 0 marking an empty slot. Its
+    // capacity is a power of two kept at least twice the number of names.
+    Array(uint32_t) slots;
+} TagNames;
+
+// Once a scanner has interned this many names, the table is cleared the next
+// time the tag stack is rebuilt, so a long-lived parser does not accumulate
+// every custom name it has ever seen.
+#define TAG_NAMES_MAX_RETAINED 1024
+
+static inline uint32_t tag_names_hash(const char *name, unsigned length) {
+    uint32_t hash = 2166136261u;
+    for (unsigned i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static inline uint32_t tag_names_count(const TagNames *self) {
+    return self->offsets.size - 1;
+}
+
+static inline const char *tag_names_get(
+    const TagNames *self,
+    uint32_t id,
+    unsigned *length
+) {
+    uint32_t start = self->offsets.contents[id - 1];
+    *length = self->offsets.contents[id] - start;
+    return &self->chars.contents[start];
+}
+
+static inline void tag_names_init(TagNames *self) {
+    array_init(&self->chars);
+    array_init(&self->offsets);
+    array_init(&self->slots);
+    array_push(&self->offsets, 0);
+}
+
+static inline void tag_names_delete(TagNames *self) {
+    array_delete(&self->chars);
+    array_delete(&self->offsets);
+    array_delete(&self->slots);
+}
+
+static inline void tag_names_clear(TagNames *self) {
+    array_clear(&self->chars);
+    self->offsets.size = 1;
+    if (self->slots.size > 0) {
+        memset(self->slots.contents, 0, self->slots.size * sizeof(uint32_t));
+    }
+}
+
+// Returns the slot holding `name`, or the empty slot where it would go.
+static inline uint32_t *tag_names_slot(
+    const TagNames *self,
+    const char *name,
+    unsigned length,
+    uint32_t hash
+) {
+    uint32_t mask = self->slots.size - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t *slot = &self->slots.contents[i];
+        if (*slot == 0) return slot;
+        unsigned slot_length;
+        const char *slot_name = tag_names_get(self, *slot, &slot_length);
+        if (slot_length == length && memcmp(slot_name, name, length) == 0) {
+            return slot;
+        }
+    }
+}
+
+// Returns the ID of `name`, or 0 if it has never been interned.
+static inline uint32_t tag_names_find(
+    const TagNames *self,
+    const char *name,
+    unsigned length
+) {
+    if (self->slots.size == 0) return 0;
+    return *tag_names_slot(self, name, length, tag_names_hash(name, length));
+}
+
+static void tag_names_grow(TagNames *self) {
+    uint32_t capacity = self->slots.size == 0 ? 16 : self->slots.size * 2;
+    array_reserve(&self->slots, capacity);
+    self->slots.size = capacity;
+    memset(self->slots.contents, 0, capacity * sizeof(uint32_t));
+    uint32_t count = tag_names_count(self);
+    for (uint32_t id = 1; id <= count; id++) {
+        unsigned length;
+        const char *name = tag_names_get(self, id, &length);
+        *tag_names_slot(self, name, length, tag_names_hash(name, length)) = id;
+    }
+}
+
+// Returns the ID of `name`, interning it first if necessary.
+static uint32_t tag_names_intern(
+    TagNames *self,
+    const char *name,
+    unsigned length
+) {
+    if (2 * (tag_names_count(self) + 1) > self->slots.size) {
+        tag_names_grow(self);
+    }
+    uint32_t *slot = tag_names_slot(self, name, length, tag_names_hash(name, length));
+    if (*slot == 0) {
+        array_extend(&self->chars, length, name);
+        array_push(&self->offsets, self->chars.size);
+        *slot = tag_names_count(self);
+    }
+    return *slot;
+}
+
 static inline Tag tag_new() {
     Tag tag;
     tag.type = END_;
-    tag.custom_tag_name = (String) array_new();
+    tag.name_id = 0;
     return tag;
 }
 
-static inline Tag tag_for_name(String name) {
+// Creates a tag from an upper-cased name, interning the names of custom tags.
+static inline Tag tag_for_name(
+    TagNames *names,
+    const char *name,
+    unsigned length
+) {
     Tag tag = tag_new();
-    tag.type = tag_type_for_name(&name);
+    tag.type = tag_type_for_name(name, length);
     if (tag.type == CUSTOM) {
-        tag.custom_tag_name = name;
-    } else {
-        array_delete(&name);
+        tag.name_id = tag_names_intern(names, name, length);
     }
     return tag;
 }
 
-static inline void tag_free(Tag *tag) {
-    if (tag->type == CUSTOM) {
-        array_delete(&tag->custom_tag_name);
+// Like tag_for_name, but does not intern anything. A custom name that was
+// never interned gets ID 0, which matches no tag on the stack.
+static inline Tag tag_find_for_name(
+    const TagNames *names,
+    const char *name,
+    unsigned length
+) {
+    Tag tag = tag_new();
+    tag.type = tag_type_for_name(name, length);
+    if (tag.type == CUSTOM) {
+        tag.name_id = tag_names_find(names, name, length);
     }
+    return tag;
 }
 
 static inline bool tag_is_void(const Tag *self) {
@@ -326,60 +511,93 @@ static inline bool tag_is_void(const Tag *self) {
 }
 
 static inline bool tag_eq(const Tag *self, const Tag *other) {
-    if (self->type != other->type) return false;
-    if (self->type == CUSTOM) {
-        if (self->custom_tag_name.size != other->custom_tag_name.size) {
-            return false;
-        }
-        if (memcmp(
-            self->custom_tag_name.contents,
-            other->custom_tag_name.contents,
-            self->custom_tag_name.size
-        ) != 0) {
-            return false;
-        }
-    }
-    return true;
+    return self->type == other->type && self->name_id == other->name_id;
 }
 
-static bool tag_can_contain(Tag *self, const Tag *other) {
-    TagType child = other->type;
-
-    switch (self->type) {
-        case LI:
-            return child != LI;
-
-        case DT:
-        case DD:
-            return child != DT && child != DD;
-
-        case P:
-            for (int i = 0; i < 26; i++) {
-                if (child == TAG_TYPES_NOT_ALLOWED_IN_PARAGRAPHS[i]) {
-                    return false;
-                }
-            }
-            return true;
+// A set of tag types, one bit per TagType. TAG_SET(LIST) builds a constant
+// set from an X-macro list of types, TAG_SET_EXCEPT(LIST) its complement.
+typedef struct {
+    uint64_t bits[2];
+} TagSet;
 
-        case COLGROUP:
-            return child == COL;
+#define TAG_SET_BIT(word, type) \
+    | ((type) >> 6 == (word) ? 1ull << ((type) & 63) : 0)
+#define TAG_SET_LOW(type) TAG_SET_BIT(0, type)
+#define TAG_SET_HIGH(type) TAG_SET_BIT(1, type)
+#define TAG_SET(LIST) {{0 LIST(TAG_SET_LOW), 0 LIST(TAG_SET_HIGH)}}
+#define TAG_SET_EXCEPT(LIST) {{~(0 LIST(TAG_SET_LOW)), ~(0 LIST(TAG_SET_HIGH))}}
 
-        case RB:
-        case RT:
-        case RP:
-            return child != RB && child != RT && child != RP;
+static inline bool tag_set_has(const TagSet *self, TagType type) {
+    return (self->bits[type >> 6] >> (type & 63)) & 1;
+}
 
-        case OPTGROUP:
-            return child != OPTGROUP;
+// Start tags that imply the end of the open element, following the HTML5
+// tree construction rules. Only the immediate parent is checked; when it is
+// closed the scanner asks again with the next element on the stack, so
+// <tbody> after a <th> closes the cell, the row and the <thead> in turn.
+#define PARAGRAPH_CLOSERS(X) \
+    X(ADDRESS) X(ARTICLE) X(ASIDE) X(BLOCKQUOTE) X(DD) X(DETAILS) X(DIALOG) \
+    X(DIV) X(DL) X(DT) X(FIELDSET) X(FIGCAPTION) X(FIGURE) X(FOOTER) \
+    X(FORM) X(H1) X(H2) X(H3) X(H4) X(H5) X(H6) X(HEADER) X(HGROUP) X(HR) \
+    X(LI) X(MAIN) X(MENU) X(NAV) X(OL) X(P) X(PRE) X(SECTION) X(SUMMARY) \
+    X(TABLE) X(UL)
+#define LIST_ITEM_CLOSERS(X) X(LI)
+#define DEFINITION_CLOSERS(X) X(DD) X(DT)
+#define HEADING_CLOSERS(X) X(H1) X(H2) X(H3) X(H4) X(H5) X(H6)
+#define ANCHOR_CLOSERS(X) X(A)
+#define BUTTON_CLOSERS(X) X(BUTTON)
+#define RUBY_TEXT_CLOSERS(X) X(RB) X(RP) X(RT) X(RTC)
+#define RUBY_CONTAINER_CLOSERS(X) X(RB) X(RTC)
+#define OPTION_CLOSERS(X) X(HR) X(OPTGROUP) X(OPTION)
+#define OPTGROUP_CLOSERS(X) X(HR) X(OPTGROUP)
+#define SELECT_CLOSERS(X) X(INPUT) X(KEYGEN) X(SELECT) X(TEXTAREA)
+#define TABLE_CLOSERS(X) X(TABLE)
+#define TABLE_SECTION_CLOSERS(X) \
+    X(CAPTION) X(COL) X(COLGROUP) X(TBODY) X(TFOOT) X(THEAD)
+#define TABLE_ROW_CLOSERS(X) TABLE_SECTION_CLOSERS(X) X(TR)
+#define TABLE_CELL_CLOSERS(X) TABLE_ROW_CLOSERS(X) X(TD) X(TH)
 
-        case TR:
-            return child != TR;
+// Elements that are closed by anything but the listed children. A custom
+// (taglib) tag never closes them, since it may expand to allowed content.
+#define HEAD_CONTENT(X) \
+    X(BASE) X(BASEFONT) X(BGSOUND) X(LINK) X(META) X(NOSCRIPT) X(SCRIPT) \
+    X(STYLE) X(TEMPLATE) X(TITLE) X(CUSTOM)
+#define COLGROUP_CONTENT(X) X(COL) X(TEMPLATE) X(CUSTOM)
 
-        case TD:
-        case TH:
-            return child != TD && child != TH && child != TR;
+// For each parent type, the child types whose start tag closes it. Types
+// without an entry, including the END_ placeholder, can contain anything.
+static const TagSet TAG_CLOSED_BY[END_ + 1] = {
+    [A] = TAG_SET(ANCHOR_CLOSERS),
+    [BUTTON] = TAG_SET(BUTTON_CLOSERS),
+    [CAPTION] = TAG_SET(TABLE_CELL_CLOSERS),
+    [COLGROUP] = TAG_SET_EXCEPT(COLGROUP_CONTENT),
+    [DD] = TAG_SET(DEFINITION_CLOSERS),
+    [DT] = TAG_SET(DEFINITION_CLOSERS),
+    [H1] = TAG_SET(HEADING_CLOSERS),
+    [H2] = TAG_SET(HEADING_CLOSERS),
+    [H3] = TAG_SET(HEADING_CLOSERS),
+    [H4] = TAG_SET(HEADING_CLOSERS),
+    [H5] = TAG_SET(HEADING_CLOSERS),
+    [H6] = TAG_SET(HEADING_CLOSERS),
+    [HEAD] = TAG_SET_EXCEPT(HEAD_CONTENT),
+    [LI] = TAG_SET(LIST_ITEM_CLOSERS),
+    [OPTGROUP] = TAG_SET(OPTGROUP_CLOSERS),
+    [OPTION] = TAG_SET(OPTION_CLOSERS),
+    [P] = TAG_SET(PARAGRAPH_CLOSERS),
+    [RB] = TAG_SET(RUBY_TEXT_CLOSERS),
+    [RP] = TAG_SET(RUBY_TEXT_CLOSERS),
+    [RT] = TAG_SET(RUBY_TEXT_CLOSERS),
+    [RTC] = TAG_SET(RUBY_CONTAINER_CLOSERS),
+    [SELECT] = TAG_SET(SELECT_CLOSERS),
+    [TABLE] = TAG_SET(TABLE_CLOSERS),
+    [TBODY] = TAG_SET(TABLE_SECTION_CLOSERS),
+    [TD] = TAG_SET(TABLE_CELL_CLOSERS),
+    [TFOOT] = TAG_SET(TABLE_SECTION_CLOSERS),
+    [TH] = TAG_SET(TABLE_CELL_CLOSERS),
+    [THEAD] = TAG_SET(TABLE_SECTION_CLOSERS),
+    [TR] = TAG_SET(TABLE_ROW_CLOSERS),
+};
 
-        default:
-            return true;
-    }
+static inline bool tag_can_contain(const Tag *self, TagType child) {
+    return !tag_set_has(&TAG_CLOSED_BY[self->type], child);
 }